@@ -1,4 +1,8 @@
 #include "canvas.h"
+#include "core/UndoCommands.h"
+#include "core/FloodFill.h"
+#include "core/ConnectedComponents.h"
+#include "core/ColorMatch.h"
 #include <QPaintEvent>
 #include <QPainter>
 #include <QFileDialog>
@@ -7,46 +11,17 @@
 #include <QLineEdit>
 #include <QFontMetrics>
 #include <QDir>
-#include <QTemporaryDir>
-#include <QProcess>
 #include <QFileInfo>
-#include <QTextStream>
 #include <cmath>
 #include <cstdlib>
-#include <QStack>
 #include <QApplication>
-#include <QRegion>
 #include <QMenu>
 #include <QAction>
 #include <QScrollBar>
 #include <QUndoStack>
 #include <QUndoCommand>
-
-// Undo command for canvas operations
-class CanvasUndoCommand : public QUndoCommand
-{
-public:
-    CanvasUndoCommand(Canvas *canvas, const QPixmap &oldPixmap, const QPixmap &newPixmap, const QString &text = "Edit")
-        : m_canvas(canvas), m_oldPixmap(oldPixmap), m_newPixmap(newPixmap)
-    {
-        setText(text);
-    }
-
-    void undo() override
-    {
-        m_canvas->setCanvasPixmap(m_oldPixmap);
-    }
-
-    void redo() override
-    {
-        m_canvas->setCanvasPixmap(m_newPixmap);
-    }
-
-private:
-    Canvas *m_canvas;
-    QPixmap m_oldPixmap;
-    QPixmap m_newPixmap;
-};
+#include <QUuid>
+#include <QThreadPool>
 
 Canvas::Canvas(QWidget *parent)
     : QWidget(parent)
@@ -60,6 +35,7 @@ Canvas::Canvas(QWidget *parent)
     , m_zoomCenter(288, 360)  // Center of canvas
     , m_magnifierRadius(150)
     , m_magnifierPosition(400, 200)
+    , m_magnifierPixels(15)
     , m_drawingInMagnifier(false)
     , m_showCoordinates(false)
     , m_mousePosition(0, 0)
@@ -98,6 +74,10 @@ Canvas::Canvas(QWidget *parent)
     , m_draggingPiece1(false)
     , m_draggingPiece2(false)
     , m_hasSelection(false)
+    , m_magicWandMode(false)
+    , m_wandContiguous(true)
+    , m_wandTolerance(32)
+    , m_wandSeed(-1, -1)
     , m_drawingLasso(false)
     , m_drawingRectSelect(false)
     , m_draggingSelection(false)
@@ -107,8 +87,11 @@ Canvas::Canvas(QWidget *parent)
     , m_currentPattern(PatternBar::Solid)
     , m_currentColor(Qt::black)
     , m_undoStack(new QUndoStack(this))
+    , m_editLayerId(0)
+    , m_undoBudget(qint64(Unimalen::DEFAULT_UNDO_BUDGET_MB) * 1024 * 1024)
     , m_isModified(false)
     , m_filePath("")
+    , m_autoSaveId(QUuid::createUuid().toString(QUuid::Id128))
 {
     setAttribute(Qt::WA_StaticContents);
     setMouseTracking(true);
@@ -127,6 +110,13 @@ Canvas::Canvas(QWidget *parent)
     fontFamilies << "Open Sans" << "Noto Sans" << "Noto Sans CJK" << "DejaVu Sans" << "Liberation Sans";
     m_textFont.setFamilies(fontFamilies);
 
+    // Warm the previous and next pages once nothing else is going on, so
+    // flipping to them only swaps in their cached composite
+    m_prefetchTimer = new QTimer(this);
+    m_prefetchTimer->setSingleShot(true);
+    m_prefetchTimer->setInterval(300);
+    connect(m_prefetchTimer, &QTimer::timeout, this, &Canvas::prefetchAdjacentPages);
+
     // Connect undo stack to mark document as modified
     connect(m_undoStack, &QUndoStack::indexChanged, this, [this]() {
         if (!m_isModified) {
@@ -137,11 +127,21 @@ Canvas::Canvas(QWidget *parent)
     newCanvas();
 }
 
+Canvas::~Canvas()
+{
+    // Closing a tab is a clean exit, nothing to recover
+    m_recoveryJournal.discard();
+}
+
 void Canvas::newCanvas()
 {
-    // Initialize the document
+    // Initialize the document, undo history refers to the old one
+    m_undoStack->clear();
+    m_undoJournal.reset();
+    m_recoveryJournal.discard();
     delete m_document;
     m_document = new Document();
+    m_document->setCompositeCacheBudget(m_undoBudget / 4);
 
     // Composite layers to main canvas
     compositeAllLayers();
@@ -184,6 +184,14 @@ bool Canvas::loadCanvas(const QString &fileName)
     bool success;
     if (extension == "ora") {
         success = m_document->loadFromORA(fileName);
+    } else if (extension == "grfx") {
+        // Replaces every page, undo history refers to the old ones
+        success = m_document->loadFromGrfx(fileName);
+        if (success) {
+            m_undoStack->clear();
+            m_undoJournal.reset();
+            updateCanvasSize();
+        }
     } else {
         success = m_document->loadFromPNG(fileName);
     }
@@ -208,20 +216,18 @@ bool Canvas::saveCanvas(const QString &fileName)
     bool success = false;
     if (extension == "ora") {
         success = m_document->saveAsORA(fileName);
+    } else if (extension == "grfx") {
+        success = m_document->saveAsGrfx(fileName);
     } else if (extension == "png") {
         success = m_document->saveAsPNG(fileName);
     } else if (extension == "jpg" || extension == "jpeg") {
-        // Convert to QImage and save as JPEG
-        QImage image = m_canvas.toImage();
-        success = image.save(fileName, "JPEG", 95); // 95% quality
+        success = m_canvas.save(fileName, "JPEG", 95); // 95% quality
     } else if (extension == "bmp") {
         // Save as BMP
-        QImage image = m_canvas.toImage();
-        success = image.save(fileName, "BMP");
+        success = m_canvas.save(fileName, "BMP");
     } else if (extension == "gif") {
         // Save as GIF
-        QImage image = m_canvas.toImage();
-        success = image.save(fileName, "GIF");
+        success = m_canvas.save(fileName, "GIF");
     } else {
         // Default to PNG for unknown extensions
         success = m_document->saveAsPNG(fileName);
@@ -237,118 +243,12 @@ bool Canvas::saveCanvas(const QString &fileName)
 
 bool Canvas::saveAsORA(const QString &fileName)
 {
-    QTemporaryDir tempDir;
-    if (!tempDir.isValid()) {
-        return false;
-    }
-
-    QString tempPath = tempDir.path();
-
-    // Create directory structure
-    QDir().mkpath(tempPath + "/data");
-    QDir().mkpath(tempPath + "/Thumbnails");
-
-    // Save the main layer as PNG
-    QString layerPath = tempPath + "/data/layer1.png";
-    if (!m_canvas.save(layerPath, "PNG")) {
-        return false;
-    }
-
-    // Create mimetype file
-    QFile mimeFile(tempPath + "/mimetype");
-    if (!mimeFile.open(QIODevice::WriteOnly)) {
-        return false;
-    }
-    mimeFile.write("image/openraster");
-    mimeFile.close();
-
-    // Create stack.xml
-    QFile stackFile(tempPath + "/stack.xml");
-    if (!stackFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        return false;
-    }
-
-    QTextStream stackStream(&stackFile);
-    stackStream << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
-    stackStream << "<image version=\"0.0.3\" w=\"" << m_document->width() << "\" h=\"" << m_document->height() << "\" xres=\"" << DPI << "\" yres=\"" << DPI << "\">\n";
-    stackStream << "  <stack>\n";
-    stackStream << "    <layer name=\"Layer 1\" src=\"data/layer1.png\" x=\"0\" y=\"0\" opacity=\"1.0\" visibility=\"visible\" composite-op=\"svg:src-over\"/>\n";
-    stackStream << "  </stack>\n";
-    stackStream << "</image>\n";
-    stackFile.close();
-
-    // Create thumbnail
-    QPixmap thumbnail = m_canvas.scaled(256, 256, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-    if (!thumbnail.save(tempPath + "/Thumbnails/thumbnail.png", "PNG")) {
-        return false;
-    }
-
-    // Create ZIP file using system zip command
-    QProcess zipProcess;
-    zipProcess.setWorkingDirectory(tempPath);
-
-    QStringList args;
-    args << "-r" << fileName << ".";
-
-    zipProcess.start("zip", args);
-    zipProcess.waitForFinished();
-
-    return zipProcess.exitCode() == 0;
+    return m_document->saveAsORA(fileName);
 }
 
 bool Canvas::loadFromORA(const QString &fileName)
 {
-    QTemporaryDir tempDir;
-    if (!tempDir.isValid()) {
-        return false;
-    }
-
-    QString tempPath = tempDir.path();
-
-    // Extract ZIP file using system unzip command
-    QProcess unzipProcess;
-    QStringList args;
-    args << fileName << "-d" << tempPath;
-
-    unzipProcess.start("unzip", args);
-    unzipProcess.waitForFinished();
-
-    if (unzipProcess.exitCode() != 0) {
-        return false;
-    }
-
-    // Check if it's a valid ORA file
-    QFile mimeFile(tempPath + "/mimetype");
-    if (!mimeFile.open(QIODevice::ReadOnly)) {
-        return false;
-    }
-    QByteArray mimeContent = mimeFile.readAll();
-    mimeFile.close();
-
-    if (mimeContent != "image/openraster") {
-        return false;
-    }
-
-    // Load the first layer (simplified - just load layer1.png)
-    QString layerPath = tempPath + "/data/layer1.png";
-    QPixmap loadedCanvas;
-    if (!loadedCanvas.load(layerPath)) {
-        return false;
-    }
-
-    // Ensure the canvas is the right size
-    if (loadedCanvas.size() != QSize(m_document->width(), m_document->height())) {
-        QPixmap newCanvas(m_document->width(), m_document->height());
-        newCanvas.fill(Qt::white);
-        QPainter painter(&newCanvas);
-        painter.drawPixmap(0, 0, loadedCanvas);
-        m_canvas = newCanvas;
-    } else {
-        m_canvas = loadedCanvas;
-    }
-
-    update();
-    return true;
+    return m_document->loadFromORA(fileName);
 }
 
 void Canvas::paintEvent(QPaintEvent *event)
@@ -362,7 +262,7 @@ void Canvas::paintEvent(QPaintEvent *event)
         QRect canvasRect = dirtyRect;
         canvasRect.setTopLeft(canvasRect.topLeft() / m_scaleFactor);
         canvasRect.setBottomRight(canvasRect.bottomRight() / m_scaleFactor);
-        painter.drawPixmap(canvasRect, m_canvas, canvasRect);
+        painter.drawImage(canvasRect, m_canvas, canvasRect);
         painter.resetTransform();
 
         // Create circular magnifying glass overlay
@@ -379,38 +279,38 @@ void Canvas::paintEvent(QPaintEvent *event)
                         m_magnifierPosition.y() - m_magnifierRadius,
                         m_magnifierRadius * 2, m_magnifierRadius * 2, Qt::white);
 
-        // Draw magnified pixels in the circular area
-        int visiblePixels = 9; // Show 9x9 pixel area in magnifier
+        // Draw magnified pixels in the circular area. The grid is one scaled
+        // blit straight from the composite; past the page edges stays white.
+        int visiblePixels = m_magnifierPixels;
         int halfVisible = visiblePixels / 2;
-        int pixelSize = (m_magnifierRadius * 2) / visiblePixels;
-
-        for (int dy = -halfVisible; dy <= halfVisible; dy++) {
-            for (int dx = -halfVisible; dx <= halfVisible; dx++) {
-                int pixelX = m_zoomCenter.x() + dx;
-                int pixelY = m_zoomCenter.y() + dy;
-
-                if (pixelX >= 0 && pixelX < m_document->width() && pixelY >= 0 && pixelY < m_document->height()) {
-                    QColor pixelColor = m_canvas.toImage().pixelColor(pixelX, pixelY);
-
-                    int screenX = m_magnifierPosition.x() - m_magnifierRadius + (dx + halfVisible) * pixelSize;
-                    int screenY = m_magnifierPosition.y() - m_magnifierRadius + (dy + halfVisible) * pixelSize;
-
-                    // Only draw if within circle
-                    QPoint pixelCenter(screenX + pixelSize/2, screenY + pixelSize/2);
-                    if (QLineF(pixelCenter, m_magnifierPosition).length() <= m_magnifierRadius - 10) {
-                        painter.fillRect(screenX + 1, screenY + 1, pixelSize - 2, pixelSize - 2, pixelColor);
+        int pixelSize = magnifierCellSize();
+        QPoint gridOrigin = magnifierGridOrigin();
+        QRect sampleRect = QRect(m_zoomCenter - QPoint(halfVisible, halfVisible), QSize(visiblePixels, visiblePixels))
+                           & m_canvas.rect();
+        if (!sampleRect.isEmpty()) {
+            QPoint offset = (sampleRect.topLeft() - m_zoomCenter + QPoint(halfVisible, halfVisible)) * pixelSize;
+            QRect screenRect(gridOrigin + offset, sampleRect.size() * pixelSize);
+            painter.drawImage(screenRect, m_canvas, sampleRect);
+        }
 
-                        // Draw grid lines
-                        painter.setPen(QPen(Qt::lightGray, 1));
-                        painter.drawRect(screenX + 1, screenY + 1, pixelSize - 2, pixelSize - 2);
-                    }
-                }
+        // Draw grid lines
+        if (pixelSize >= 4) {
+            QVector<QLine> gridLines;
+            gridLines.reserve((visiblePixels + 1) * 2);
+            int gridExtent = visiblePixels * pixelSize;
+            for (int i = 0; i <= visiblePixels; i++) {
+                gridLines.append(QLine(gridOrigin.x() + i * pixelSize, gridOrigin.y(),
+                                       gridOrigin.x() + i * pixelSize, gridOrigin.y() + gridExtent));
+                gridLines.append(QLine(gridOrigin.x(), gridOrigin.y() + i * pixelSize,
+                                       gridOrigin.x() + gridExtent, gridOrigin.y() + i * pixelSize));
             }
+            painter.setPen(QPen(Qt::lightGray, 1));
+            painter.drawLines(gridLines);
         }
 
         // Highlight the center pixel (current zoom center)
-        int centerScreenX = m_magnifierPosition.x() - pixelSize/2;
-        int centerScreenY = m_magnifierPosition.y() - pixelSize/2;
+        int centerScreenX = gridOrigin.x() + halfVisible * pixelSize;
+        int centerScreenY = gridOrigin.y() + halfVisible * pixelSize;
         painter.setPen(QPen(Qt::red, 2));
         painter.drawRect(centerScreenX + 1, centerScreenY + 1, pixelSize - 2, pixelSize - 2);
 
@@ -454,7 +354,7 @@ void Canvas::paintEvent(QPaintEvent *event)
     canvasRect.setTopLeft(canvasRect.topLeft() / m_scaleFactor);
     canvasRect.setBottomRight(canvasRect.bottomRight() / m_scaleFactor);
 
-    painter.drawPixmap(canvasRect, m_canvas, canvasRect);
+    painter.drawImage(canvasRect, m_canvas, canvasRect);
 
     // Reset transform to draw coordinate system in screen coordinates
     painter.resetTransform();
@@ -641,21 +541,26 @@ void Canvas::paintEvent(QPaintEvent *event)
 
     // Draw scissors pieces if they exist
     if (m_hasScissorsPieces) {
+        QRect piece1Rect = m_scissorsMask1.boundingRect().translated(m_piece1Offset);
+        QRect piece2Rect = m_scissorsMask2.boundingRect().translated(m_piece2Offset);
+
         // Draw piece 1
-        painter.drawPixmap(m_piece1Offset, m_scissorsPiece1);
+        painter.drawImage(piece1Rect.topLeft(), m_scissorsPiece1);
         // Draw border around piece 1
         painter.setPen(QPen(Qt::blue, 2, Qt::DashLine));
         painter.setBrush(Qt::NoBrush);
-        QRect piece1Rect = m_scissorsRegion1.boundingRect().translated(m_piece1Offset);
-        painter.drawRect(piece1Rect);
+        if (!m_scissorsMask1.isEmpty()) {
+            painter.drawRect(piece1Rect);
+        }
 
         // Draw piece 2
-        painter.drawPixmap(m_piece2Offset, m_scissorsPiece2);
+        painter.drawImage(piece2Rect.topLeft(), m_scissorsPiece2);
         // Draw border around piece 2
         painter.setPen(QPen(Qt::green, 2, Qt::DashLine));
         painter.setBrush(Qt::NoBrush);
-        QRect piece2Rect = m_scissorsRegion2.boundingRect().translated(m_piece2Offset);
-        painter.drawRect(piece2Rect);
+        if (!m_scissorsMask2.isEmpty()) {
+            painter.drawRect(piece2Rect);
+        }
     }
 
     // Draw lasso selection
@@ -671,36 +576,24 @@ void Canvas::paintEvent(QPaintEvent *event)
             painter.setBrush(Qt::NoBrush);
             painter.drawPolygon(m_lassoPolygon);
 
-            // If dragging, show the selected pixels at the current position
-            if (m_draggingSelection && !m_selectedPixmap.isNull()) {
-                QRect newBoundingRect = m_lassoPolygon.boundingRect();
-
-                // Create a mask from the current polygon position
-                QPixmap mask(newBoundingRect.size());
-                mask.fill(Qt::black);
-
-                QPainter maskPainter(&mask);
-                maskPainter.setBrush(Qt::white);
-                maskPainter.setPen(Qt::NoPen);
-
-                // Translate polygon to mask coordinates
-                QPolygon translatedPolygon;
-                for (const QPoint &point : m_lassoPolygon) {
-                    translatedPolygon << (point - newBoundingRect.topLeft());
-                }
-                maskPainter.drawPolygon(translatedPolygon);
-
-                // Scale and mask the selected pixmap
-                QPixmap scaledPixmap = m_selectedPixmap.scaled(newBoundingRect.size(), Qt::KeepAspectRatio, Qt::SmoothTransformation);
-                scaledPixmap.setMask(mask.createHeuristicMask());
-
-                // Draw the masked pixmap at the current position
+            // If dragging, show the selected pixels at the current position;
+            // they were masked once when the drag started
+            if (m_draggingSelection && !m_selectedImage.isNull()) {
                 painter.setRenderHint(QPainter::Antialiasing, false);
-                painter.drawPixmap(newBoundingRect.topLeft(), scaledPixmap);
+                painter.drawImage(m_selection.boundingRect().topLeft(), m_selectedImage);
             }
         }
     }
 
+    // Wand selections have no outline, their area is tinted instead
+    if (m_lassoMode && m_lassoPolygon.isEmpty() && m_hasSelection && !m_selection.isEmpty()) {
+        QPoint topLeft = m_selection.boundingRect().topLeft();
+        if (m_draggingSelection && !m_selectedImage.isNull()) {
+            painter.drawImage(topLeft, m_selectedImage);
+        }
+        painter.drawImage(topLeft, m_selectionOverlay);
+    }
+
     // Draw rectangular selection
     if (m_drawingRectSelect || (m_hasSelection && m_rectSelectMode)) {
         QRect drawRect;
@@ -711,15 +604,13 @@ void Canvas::paintEvent(QPaintEvent *event)
             painter.setBrush(Qt::NoBrush);
         } else if (m_hasSelection) {
             // Show completed selection - dashed line
-            drawRect = m_rectSelection;
+            drawRect = m_draggingSelection ? m_selection.boundingRect() : m_rectSelection;
             painter.setPen(QPen(Qt::black, 1, Qt::DashLine));
             painter.setBrush(Qt::NoBrush);
 
             // If dragging, show the selected pixels at the current position
-            if (m_draggingSelection && !m_selectedPixmap.isNull()) {
-                QRect scaledRect = QRect(drawRect.topLeft() * m_scaleFactor,
-                                        drawRect.size() * m_scaleFactor);
-                painter.drawPixmap(scaledRect.topLeft(), m_selectedPixmap.scaled(scaledRect.size()));
+            if (m_draggingSelection && !m_selectedImage.isNull()) {
+                painter.drawImage(drawRect.topLeft(), m_selectedImage);
             }
         }
 
@@ -745,7 +636,7 @@ void Canvas::mousePressEvent(QMouseEvent *event)
             QPoint clickPos = mapToCanvas(event->position().toPoint());
 
             // Check piece 2 first (drawn on top)
-            QRect piece2Rect = m_scissorsRegion2.boundingRect().translated(m_piece2Offset);
+            QRect piece2Rect = m_scissorsMask2.boundingRect().translated(m_piece2Offset);
             if (piece2Rect.contains(clickPos)) {
                 m_draggingPiece2 = true;
                 m_pieceDragStart = clickPos - m_piece2Offset;
@@ -753,7 +644,7 @@ void Canvas::mousePressEvent(QMouseEvent *event)
             }
 
             // Check piece 1
-            QRect piece1Rect = m_scissorsRegion1.boundingRect().translated(m_piece1Offset);
+            QRect piece1Rect = m_scissorsMask1.boundingRect().translated(m_piece1Offset);
             if (piece1Rect.contains(clickPos)) {
                 m_draggingPiece1 = true;
                 m_pieceDragStart = clickPos - m_piece1Offset;
@@ -761,19 +652,7 @@ void Canvas::mousePressEvent(QMouseEvent *event)
             }
 
             // Clicked outside both pieces - commit them
-            QPainter painter(&currentLayer().pixmap());
-            painter.setRenderHint(QPainter::Antialiasing, false);
-
-            painter.drawPixmap(m_piece1Offset, m_scissorsPiece1);
-            painter.drawPixmap(m_piece2Offset, m_scissorsPiece2);
-
-            // Clear scissors state
-            m_hasScissorsPieces = false;
-            m_scissorsPiece1 = QPixmap();
-            m_scissorsPiece2 = QPixmap();
-
-            compositeAllLayers();
-            update();
+            commitScissorsPieces();
             // Don't return - continue with normal click handling
         }
 
@@ -785,19 +664,9 @@ void Canvas::mousePressEvent(QMouseEvent *event)
             QLineF distanceToMagnifier(clickPos, m_magnifierPosition);
             if (distanceToMagnifier.length() <= m_magnifierRadius) {
                 // Click is in magnifier - convert to pixel coordinates for drawing
-                int visiblePixels = 9;
-                int halfVisible = visiblePixels / 2;
-                int pixelSize = (m_magnifierRadius * 2) / visiblePixels;
-
-                // Calculate which pixel was clicked in the magnifier
-                int relativeX = clickPos.x() - (m_magnifierPosition.x() - m_magnifierRadius);
-                int relativeY = clickPos.y() - (m_magnifierPosition.y() - m_magnifierRadius);
-
-                int pixelOffsetX = (relativeX / pixelSize) - halfVisible;
-                int pixelOffsetY = (relativeY / pixelSize) - halfVisible;
-
-                int targetPixelX = m_zoomCenter.x() + pixelOffsetX;
-                int targetPixelY = m_zoomCenter.y() + pixelOffsetY;
+                QPoint targetPixel = magnifierPixelAt(clickPos);
+                int targetPixelX = targetPixel.x();
+                int targetPixelY = targetPixel.y();
 
                 // Draw on the target pixel if it's valid
                 if (targetPixelX >= 0 && targetPixelX < m_document->width() &&
@@ -806,10 +675,11 @@ void Canvas::mousePressEvent(QMouseEvent *event)
                     if (m_pencilMode) {
                         saveCanvasState();
                         m_drawingInMagnifier = true;
-                        QPainter painter(&currentLayer().pixmap());
+                        QPainter painter(&currentLayer().image());
                         // Use pen color set by caller;
                         painter.drawPoint(targetPixelX, targetPixelY);
-                        compositeAllLayers();
+                        painter.end();
+                        compositeDirtyRect(QRect(targetPixel, QSize(1, 1)));
                         update();
                     }
                 }
@@ -826,7 +696,7 @@ void Canvas::mousePressEvent(QMouseEvent *event)
 
         if (m_pencilMode) {
             // Save canvas state before drawing
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             m_lastPoint = mapToCanvas(event->position().toPoint());
             m_drawing = true;
         } else if (m_textMode) {
@@ -849,33 +719,33 @@ void Canvas::mousePressEvent(QMouseEvent *event)
                 startTextInput(mapToCanvas(event->position().toPoint()));
             }
         } else if (m_sprayMode) {
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             m_drawing = true;
             sprayPaint(mapToCanvas(event->position().toPoint()));
         } else if (m_brushMode) {
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             m_lastPoint = mapToCanvas(event->position().toPoint());
             m_drawing = true;
             brushPaint(mapToCanvas(event->position().toPoint()));
         } else if (m_markerMode) {
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             m_lastPoint = mapToCanvas(event->position().toPoint());
             m_drawing = true;
             markerPaint(mapToCanvas(event->position().toPoint()));
         } else if (m_eraserMode) {
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             m_lastPoint = mapToCanvas(event->position().toPoint());
             m_drawing = true;
             eraserPaint(mapToCanvas(event->position().toPoint()));
         } else if (m_lineMode) {
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             m_lineStartPoint = mapToCanvas(event->position().toPoint());
             m_lineCurrentPoint = m_lineStartPoint;
             m_showLinePreview = true;
             m_drawing = true;
         } else if (m_bezierMode) {
             if (m_bezierClickCount == 0) {
-                m_canvasBeforeEdit = m_canvas;
+                saveCanvasState();
             }
             m_bezierPoints[m_bezierClickCount] = mapToCanvas(event->position().toPoint());
             m_bezierClickCount++;
@@ -883,14 +753,14 @@ void Canvas::mousePressEvent(QMouseEvent *event)
             if (m_bezierClickCount == 4) {
                 // Draw the bezier curve with all 4 points
                 drawBezierCurve(m_bezierPoints[0], m_bezierPoints[1], m_bezierPoints[2], m_bezierPoints[3]);
-                m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, "Bezier Curve"));
+                pushLayerUndo("Bezier Curve");
                 m_bezierClickCount = 0;  // Reset for next curve
             }
             update();
         } else if (m_fillMode) {
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             floodFill(mapToCanvas(event->position().toPoint()), m_currentColor);
-            m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, "Fill"));
+            pushLayerUndo("Fill");
         } else if (m_lassoMode) {
             QPoint clickPoint = mapToCanvas(event->position().toPoint());
 
@@ -902,20 +772,19 @@ void Canvas::mousePressEvent(QMouseEvent *event)
                 setCursor(Qt::ClosedHandCursor);
 
                 // Save canvas state for undo
-                m_canvasBeforeEdit = m_canvas;
+                saveCanvasState();
 
                 // Extract the selected pixels
-                QRect boundingRect = m_lassoPolygon.boundingRect();
-                m_selectedPixmap = m_canvas.copy(boundingRect);
-                m_selectionOffset = boundingRect.topLeft();
+                m_selectedImage = m_selection.copy(m_canvas);
+                m_selectionOffset = m_selection.boundingRect().topLeft();
+                m_wandSeed = QPoint(-1, -1); // Moved pixels no longer match the seed
 
                 // Clear the selected area from canvas
-                QPainter painter(&currentLayer().pixmap());
-                painter.setCompositionMode(QPainter::CompositionMode_Clear);
-                painter.setClipRegion(QRegion(m_lassoPolygon));
-                painter.fillRect(currentLayer().pixmap().rect(), Qt::black);
-                compositeAllLayers();
+                m_selection.clear(currentLayer().image());
+                compositeDirtyRect(m_selection.boundingRect());
                 update();
+            } else if (m_magicWandMode) {
+                magicWandSelect(clickPoint);
             } else {
                 // Start new lasso selection
                 m_lassoPolygon.clear();
@@ -929,24 +798,22 @@ void Canvas::mousePressEvent(QMouseEvent *event)
             QPoint clickPoint = mapToCanvas(event->position().toPoint());
 
             // Check if clicking inside existing selection to start dragging
-            if (m_hasSelection && !m_drawingRectSelect && m_rectSelection.contains(clickPoint)) {
+            if (m_hasSelection && !m_drawingRectSelect && isPointInSelection(clickPoint)) {
                 m_draggingSelection = true;
                 m_dragStartPoint = clickPoint;
                 m_drawing = true;
                 setCursor(Qt::ClosedHandCursor);
 
                 // Save canvas state for undo
-                m_canvasBeforeEdit = m_canvas;
+                saveCanvasState();
 
                 // Extract the selected pixels
-                m_selectedPixmap = m_canvas.copy(m_rectSelection);
-                m_selectionOffset = m_rectSelection.topLeft();
+                m_selectedImage = m_selection.copy(m_canvas);
+                m_selectionOffset = m_selection.boundingRect().topLeft();
 
                 // Clear the selected area from canvas
-                QPainter painter(&currentLayer().pixmap());
-                painter.setCompositionMode(QPainter::CompositionMode_Clear);
-                painter.fillRect(m_rectSelection, Qt::black);
-                compositeAllLayers();
+                m_selection.clear(currentLayer().image());
+                compositeDirtyRect(m_selection.boundingRect());
                 update();
             } else {
                 // Start new rectangular selection
@@ -962,31 +829,31 @@ void Canvas::mousePressEvent(QMouseEvent *event)
             QPoint clickPoint = mapToCanvas(event->position().toPoint());
             if (clickPoint.x() >= 0 && clickPoint.x() < m_document->width() &&
                 clickPoint.y() >= 0 && clickPoint.y() < m_document->height()) {
-                QColor pickedColor = m_canvas.toImage().pixelColor(clickPoint);
+                QColor pickedColor = m_canvas.pixelColor(clickPoint);
                 m_currentColor = pickedColor;
                 // Emit signal or call a method to update the color in ColorBar
                 emit colorPicked(pickedColor);
             }
         } else if (m_squareMode || m_filledSquareMode) {
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             m_squareStartPoint = mapToCanvas(event->position().toPoint());
             m_squareCurrentPoint = m_squareStartPoint;
             m_showSquarePreview = true;
             m_drawing = true;
         } else if (m_roundedSquareMode || m_filledRoundedSquareMode) {
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             m_roundedSquareStartPoint = mapToCanvas(event->position().toPoint());
             m_roundedSquareCurrentPoint = m_roundedSquareStartPoint;
             m_showRoundedSquarePreview = true;
             m_drawing = true;
         } else if (m_ovalMode || m_filledOvalMode) {
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             m_ovalStartPoint = mapToCanvas(event->position().toPoint());
             m_ovalCurrentPoint = m_ovalStartPoint;
             m_showOvalPreview = true;
             m_drawing = true;
         } else if (m_scissorsMode) {
-            m_canvasBeforeEdit = m_canvas;
+            saveCanvasState();
             m_scissorsCutLine.clear();
             m_scissorsCutLine << mapToCanvas(event->position().toPoint());
             m_drawingScissors = true;
@@ -1063,29 +930,20 @@ void Canvas::mouseMoveEvent(QMouseEvent *event)
         QLineF distanceToMagnifier(clickPos, m_magnifierPosition);
         if (distanceToMagnifier.length() <= m_magnifierRadius) {
             // Drag is in magnifier - convert to pixel coordinates for drawing
-            int visiblePixels = 9;
-            int halfVisible = visiblePixels / 2;
-            int pixelSize = (m_magnifierRadius * 2) / visiblePixels;
-
-            // Calculate which pixel is being dragged over
-            int relativeX = clickPos.x() - (m_magnifierPosition.x() - m_magnifierRadius);
-            int relativeY = clickPos.y() - (m_magnifierPosition.y() - m_magnifierRadius);
-
-            int pixelOffsetX = (relativeX / pixelSize) - halfVisible;
-            int pixelOffsetY = (relativeY / pixelSize) - halfVisible;
-
-            int targetPixelX = m_zoomCenter.x() + pixelOffsetX;
-            int targetPixelY = m_zoomCenter.y() + pixelOffsetY;
+            QPoint targetPixel = magnifierPixelAt(clickPos);
+            int targetPixelX = targetPixel.x();
+            int targetPixelY = targetPixel.y();
 
             // Draw on the target pixel if it's valid and different from last
             if (targetPixelX >= 0 && targetPixelX < m_document->width() &&
                 targetPixelY >= 0 && targetPixelY < m_document->height()) {
 
                 if (m_pencilMode && m_drawingInMagnifier) {
-                    QPainter painter(&currentLayer().pixmap());
+                    QPainter painter(&currentLayer().image());
                     // Use pen color set by caller;
                     painter.drawPoint(targetPixelX, targetPixelY);
-                    compositeAllLayers();
+                    painter.end();
+                    compositeDirtyRect(QRect(targetPixel, QSize(1, 1)));
                     update();
                 }
             }
@@ -1169,12 +1027,9 @@ void Canvas::mouseMoveEvent(QMouseEvent *event)
         QPoint currentPoint = mapToCanvas(event->position().toPoint());
         QPoint offset = currentPoint - m_dragStartPoint;
 
-        // Update selection polygon position
-        QPolygon newPolygon;
-        for (const QPoint &point : m_lassoPolygon) {
-            newPolygon << (point + offset);
-        }
-        m_lassoPolygon = newPolygon;
+        // Update selection position, its mask moves along unchanged
+        m_lassoPolygon.translate(offset);
+        m_selection.translate(offset);
 
         m_dragStartPoint = currentPoint;
         update(); // Trigger repaint to show updated selection position
@@ -1194,21 +1049,7 @@ void Canvas::mouseReleaseEvent(QMouseEvent *event)
         // Handle scissors piece dragging completion
         if (m_draggingPiece1 || m_draggingPiece2) {
             // Commit the pieces to the layer at their current positions
-            QPainter painter(&currentLayer().pixmap());
-            painter.setRenderHint(QPainter::Antialiasing, false);
-
-            painter.drawPixmap(m_piece1Offset, m_scissorsPiece1);
-            painter.drawPixmap(m_piece2Offset, m_scissorsPiece2);
-
-            // Clear scissors state
-            m_hasScissorsPieces = false;
-            m_draggingPiece1 = false;
-            m_draggingPiece2 = false;
-            m_scissorsPiece1 = QPixmap();
-            m_scissorsPiece2 = QPixmap();
-
-            compositeAllLayers();
-            update();
+            commitScissorsPieces();
             return;
         }
 
@@ -1220,7 +1061,7 @@ void Canvas::mouseReleaseEvent(QMouseEvent *event)
 
         // Handle pixel zoom mode drawing completion
         if (m_drawingInMagnifier) {
-            m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, "Pixel Edit"));
+            pushLayerUndo("Pixel Edit");
             m_drawingInMagnifier = false;
             return;
         }
@@ -1230,46 +1071,23 @@ void Canvas::mouseReleaseEvent(QMouseEvent *event)
         if (m_pencilMode) {
             drawLineTo(mapToCanvas(event->position().toPoint()));
             // Create undo command for pencil drawing
-            m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, "Pencil"));
+            pushLayerUndo("Pencil");
         } else if (m_lineMode) {
             drawStraightLine(m_lineStartPoint, mapToCanvas(event->position().toPoint()));
             m_showLinePreview = false; // Hide preview after drawing final line
-            m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, "Line"));
+            pushLayerUndo("Line");
         } else if (m_lassoMode) {
             if (m_draggingSelection) {
                 // Complete selection dragging - place the selected pixels at new location
-                QRect newBoundingRect = m_lassoPolygon.boundingRect();
-
-                // Draw the selected pixels at the new location
-                QPainter painter(&currentLayer().pixmap());
+                QPainter painter(&currentLayer().image());
                 painter.setRenderHint(QPainter::Antialiasing, false);
-
-                // Create a mask from the new polygon position
-                QPixmap mask(newBoundingRect.size());
-                mask.fill(Qt::black);
-
-                QPainter maskPainter(&mask);
-                maskPainter.setBrush(Qt::white);
-                maskPainter.setPen(Qt::NoPen);
-
-                // Translate polygon to mask coordinates
-                QPolygon translatedPolygon;
-                for (const QPoint &point : m_lassoPolygon) {
-                    translatedPolygon << (point - newBoundingRect.topLeft());
-                }
-                maskPainter.drawPolygon(translatedPolygon);
-
-                // Scale the selected pixmap if needed
-                QPixmap scaledPixmap = m_selectedPixmap.scaled(newBoundingRect.size(), Qt::KeepAspectRatio, Qt::SmoothTransformation);
-                scaledPixmap.setMask(mask.createHeuristicMask());
-
-                // Draw the masked pixmap at the new location
-                painter.drawPixmap(newBoundingRect.topLeft(), scaledPixmap);
+                painter.drawImage(m_selection.boundingRect().topLeft(), m_selectedImage);
+                painter.end();
 
                 compositeAllLayers();
 
                 // Create undo command for the move operation
-                m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, "Move Selection"));
+                pushLayerUndo("Move Selection");
 
                 m_draggingSelection = false;
                 setCursor(Qt::ArrowCursor);
@@ -1278,6 +1096,8 @@ void Canvas::mouseReleaseEvent(QMouseEvent *event)
                 // Complete lasso selection
                 m_drawingLasso = false; // Stop showing drawing preview
                 if (m_lassoPolygon.size() > 2) {
+                    // Rasterized once, reused for hit-testing, dragging and copying
+                    m_selection = Unimalen::Selection::fromPolygon(m_lassoPolygon, m_canvas.rect());
                     m_hasSelection = true;
                     update(); // Show completed selection with dashed outline
                 } else {
@@ -1292,18 +1112,20 @@ void Canvas::mouseReleaseEvent(QMouseEvent *event)
                 QPoint currentPoint = mapToCanvas(event->position().toPoint());
                 QPoint offset = currentPoint - m_dragStartPoint;
 
-                // Update rectangle position
-                m_rectSelection.translate(offset);
+                // Update rectangle position, the selection followed the drag
+                m_selection.translate(offset);
+                m_rectSelection = m_selection.boundingRect();
 
                 // Draw the selected pixels at the new location
-                QPainter painter(&currentLayer().pixmap());
+                QPainter painter(&currentLayer().image());
                 painter.setRenderHint(QPainter::Antialiasing, false);
-                painter.drawPixmap(m_rectSelection.topLeft(), m_selectedPixmap);
+                painter.drawImage(m_selection.boundingRect().topLeft(), m_selectedImage);
+                painter.end();
 
                 compositeAllLayers();
 
                 // Create undo command for the move operation
-                m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, "Move Selection"));
+                pushLayerUndo("Move Selection");
 
                 m_draggingSelection = false;
                 setCursor(Qt::ArrowCursor);
@@ -1314,6 +1136,7 @@ void Canvas::mouseReleaseEvent(QMouseEvent *event)
                 QRect selectedRect = QRect(m_rectSelectStart, m_rectSelectCurrent).normalized();
                 if (selectedRect.width() > 2 && selectedRect.height() > 2) {
                     m_rectSelection = selectedRect;
+                    m_selection = Unimalen::Selection::fromRect(selectedRect, m_canvas.rect());
                     m_hasSelection = true;
                     update(); // Show completed selection with dashed outline
                 } else {
@@ -1324,26 +1147,26 @@ void Canvas::mouseReleaseEvent(QMouseEvent *event)
         } else if (m_squareMode || m_filledSquareMode) {
             drawSquare(m_squareStartPoint, mapToCanvas(event->position().toPoint()), m_filledSquareMode);
             m_showSquarePreview = false; // Hide preview after drawing final square
-            m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, m_filledSquareMode ? "Filled Rectangle" : "Rectangle"));
+            pushLayerUndo(m_filledSquareMode ? "Filled Rectangle" : "Rectangle");
         } else if (m_roundedSquareMode || m_filledRoundedSquareMode) {
             drawRoundedSquare(m_roundedSquareStartPoint, mapToCanvas(event->position().toPoint()), m_filledRoundedSquareMode);
             m_showRoundedSquarePreview = false; // Hide preview after drawing final rounded square
-            m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, m_filledRoundedSquareMode ? "Filled Rounded Rectangle" : "Rounded Rectangle"));
+            pushLayerUndo(m_filledRoundedSquareMode ? "Filled Rounded Rectangle" : "Rounded Rectangle");
         } else if (m_ovalMode || m_filledOvalMode) {
             drawOval(m_ovalStartPoint, mapToCanvas(event->position().toPoint()), m_filledOvalMode);
             m_showOvalPreview = false; // Hide preview after drawing final oval
-            m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, m_filledOvalMode ? "Filled Oval" : "Oval"));
+            pushLayerUndo(m_filledOvalMode ? "Filled Oval" : "Oval");
         } else if (m_scissorsMode && m_drawingScissors) {
             m_scissorsCutLine << mapToCanvas(event->position().toPoint());
             performScissorsCut(m_scissorsCutLine);
             m_drawingScissors = false;
-            m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, "Scissors Cut"));
+            pushLayerUndo("Scissors Cut");
         }
 
         // Add undo commands for continuous drawing tools
         if (m_sprayMode || m_brushMode || m_markerMode || m_eraserMode) {
             QString toolName = m_sprayMode ? "Spray" : (m_brushMode ? "Brush" : (m_markerMode ? "Marker" : "Eraser"));
-            m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, toolName));
+            pushLayerUndo(toolName);
         }
 
         m_drawing = false;
@@ -1357,7 +1180,7 @@ QPoint Canvas::mapToCanvas(const QPoint &point)
 
 void Canvas::drawLineTo(const QPoint &endPoint)
 {
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
 
     if (m_currentPattern == PatternBar::Solid) {
         // For solid pattern, use regular line drawing
@@ -1390,14 +1213,15 @@ void Canvas::drawLineTo(const QPoint &endPoint)
         painter.setPen(Qt::NoPen);
         painter.drawPath(strokedPath);
     }
-
-    compositeAllLayers();
+    painter.end();
 
     int rad = (m_currentPattern == PatternBar::Solid) ? 1 : 2;
-    QRect updateRect = QRect(m_lastPoint, endPoint).normalized()
-                       .adjusted(-rad, -rad, +rad, +rad);
-    updateRect = QRect(updateRect.topLeft() * m_scaleFactor,
-                      updateRect.bottomRight() * m_scaleFactor);
+    QRect dirtyRect = QRect(m_lastPoint, endPoint).normalized()
+                      .adjusted(-rad, -rad, +rad, +rad);
+    compositeDirtyRect(dirtyRect);
+
+    QRect updateRect = QRect(dirtyRect.topLeft() * m_scaleFactor,
+                             dirtyRect.bottomRight() * m_scaleFactor);
     update(updateRect);
 
     m_lastPoint = endPoint;
@@ -1405,7 +1229,7 @@ void Canvas::drawLineTo(const QPoint &endPoint)
 
 void Canvas::sprayPaint(const QPoint &position)
 {
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
 
     // Set up brush with current pattern
     QBrush patternBrush;
@@ -1438,21 +1262,22 @@ void Canvas::sprayPaint(const QPoint &position)
             painter.drawRect(x - dotSize/2, y - dotSize/2, dotSize, dotSize);
         }
     }
+    painter.end();
 
-    compositeAllLayers();
-
-    // Update the affected area
+    // Re-blend and update only the affected area
     int updateRadius = m_sprayDiameter / 2 + 2;
-    QRect updateRect = QRect(position.x() - updateRadius, position.y() - updateRadius,
+    QRect dirtyRect = QRect(position.x() - updateRadius, position.y() - updateRadius,
                             updateRadius * 2, updateRadius * 2);
-    updateRect = QRect(updateRect.topLeft() * m_scaleFactor,
-                      updateRect.bottomRight() * m_scaleFactor);
+    compositeDirtyRect(dirtyRect);
+
+    QRect updateRect = QRect(dirtyRect.topLeft() * m_scaleFactor,
+                             dirtyRect.bottomRight() * m_scaleFactor);
     update(updateRect);
 }
 
 void Canvas::brushPaint(const QPoint &position)
 {
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
     painter.setRenderHint(QPainter::Antialiasing);
 
     // Set up brush properties with current pattern
@@ -1475,21 +1300,22 @@ void Canvas::brushPaint(const QPoint &position)
     if (brushRect.intersects(QRect(0, 0, m_document->width(), m_document->height()))) {
         painter.drawEllipse(brushRect);
     }
+    painter.end();
 
-    compositeAllLayers();
-
-    // Update the affected area
+    // Re-blend and update only the affected area
     int updateRadius = radius + 2;
-    QRect updateRect = QRect(position.x() - updateRadius, position.y() - updateRadius,
+    QRect dirtyRect = QRect(position.x() - updateRadius, position.y() - updateRadius,
                             updateRadius * 2, updateRadius * 2);
-    updateRect = QRect(updateRect.topLeft() * m_scaleFactor,
-                      updateRect.bottomRight() * m_scaleFactor);
+    compositeDirtyRect(dirtyRect);
+
+    QRect updateRect = QRect(dirtyRect.topLeft() * m_scaleFactor,
+                             dirtyRect.bottomRight() * m_scaleFactor);
     update(updateRect);
 }
 
 void Canvas::markerPaint(const QPoint &position)
 {
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
     painter.setRenderHint(QPainter::Antialiasing);
     painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
 
@@ -1506,23 +1332,24 @@ void Canvas::markerPaint(const QPoint &position)
     if (m_drawing) {
         painter.drawLine(m_lastPoint, position);
     }
+    painter.end();
 
-    compositeAllLayers();
-
-    // Update the affected area
+    // Re-blend and update only the affected area
     int updateRadius = (thickness * 1.5) + 2;
-    QRect updateRect = QRect(qMin(m_lastPoint.x(), position.x()) - updateRadius,
+    QRect dirtyRect = QRect(qMin(m_lastPoint.x(), position.x()) - updateRadius,
                             qMin(m_lastPoint.y(), position.y()) - updateRadius,
                             qAbs(position.x() - m_lastPoint.x()) + updateRadius * 2,
                             qAbs(position.y() - m_lastPoint.y()) + updateRadius * 2);
-    updateRect = QRect(updateRect.topLeft() * m_scaleFactor,
-                      updateRect.bottomRight() * m_scaleFactor);
+    compositeDirtyRect(dirtyRect);
+
+    QRect updateRect = QRect(dirtyRect.topLeft() * m_scaleFactor,
+                             dirtyRect.bottomRight() * m_scaleFactor);
     update(updateRect);
 }
 
 void Canvas::eraserPaint(const QPoint &position)
 {
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
     painter.setRenderHint(QPainter::Antialiasing);
     painter.setCompositionMode(QPainter::CompositionMode_Clear);
 
@@ -1539,15 +1366,16 @@ void Canvas::eraserPaint(const QPoint &position)
     if (eraserRect.intersects(QRect(0, 0, m_document->width(), m_document->height()))) {
         painter.drawEllipse(eraserRect);
     }
+    painter.end();
 
-    compositeAllLayers();
-
-    // Update the affected area
+    // Re-blend and update only the affected area
     int updateRadius = radius + 2;
-    QRect updateRect = QRect(position.x() - updateRadius, position.y() - updateRadius,
+    QRect dirtyRect = QRect(position.x() - updateRadius, position.y() - updateRadius,
                             updateRadius * 2, updateRadius * 2);
-    updateRect = QRect(updateRect.topLeft() * m_scaleFactor,
-                      updateRect.bottomRight() * m_scaleFactor);
+    compositeDirtyRect(dirtyRect);
+
+    QRect updateRect = QRect(dirtyRect.topLeft() * m_scaleFactor,
+                             dirtyRect.bottomRight() * m_scaleFactor);
     update(updateRect);
 }
 
@@ -1564,21 +1392,7 @@ void Canvas::keyPressEvent(QKeyEvent *event)
     // Handle Escape key for scissors pieces
     if (event->key() == Qt::Key_Escape && m_hasScissorsPieces) {
         // Commit the pieces at their current positions
-        QPainter painter(&currentLayer().pixmap());
-        painter.setRenderHint(QPainter::Antialiasing, false);
-
-        painter.drawPixmap(m_piece1Offset, m_scissorsPiece1);
-        painter.drawPixmap(m_piece2Offset, m_scissorsPiece2);
-
-        // Clear scissors state
-        m_hasScissorsPieces = false;
-        m_draggingPiece1 = false;
-        m_draggingPiece2 = false;
-        m_scissorsPiece1 = QPixmap();
-        m_scissorsPiece2 = QPixmap();
-
-        compositeAllLayers();
-        update();
+        commitScissorsPieces();
         return;
     }
 
@@ -1610,12 +1424,21 @@ void Canvas::keyPressEvent(QKeyEvent *event)
                 // Paint current pixel with selected color/pattern
                 if (m_pencilMode) {
                     saveCanvasState();
-                    QPainter painter(&currentLayer().pixmap());
+                    QPainter painter(&currentLayer().image());
                     // Use pen color set by caller;
                     painter.drawPoint(m_zoomCenter);
+                    painter.end();
+                    compositeDirtyRect(QRect(m_zoomCenter, QSize(1, 1)));
                     update();
                 }
                 return;
+            case Qt::Key_Plus:
+            case Qt::Key_Equal:
+                setMagnifierPixels(m_magnifierPixels + 2);
+                return;
+            case Qt::Key_Minus:
+                setMagnifierPixels(m_magnifierPixels - 2);
+                return;
         }
     }
 
@@ -1694,9 +1517,9 @@ void Canvas::commitText()
         m_textPosition = QPoint(widgetPos.x() / m_scaleFactor, widgetPos.y() / m_scaleFactor);
 
         // Save canvas state for undo
-        m_canvasBeforeEdit = m_canvas;
+        saveCanvasState();
 
-        QPainter painter(&currentLayer().pixmap());
+        QPainter painter(&currentLayer().image());
         painter.setFont(m_textFont);
         painter.setPen(m_currentColor);
 
@@ -1710,7 +1533,7 @@ void Canvas::commitText()
         compositeAllLayers();
 
         // Create undo command for text input
-        m_undoStack->push(new CanvasUndoCommand(this, m_canvasBeforeEdit, m_canvas, "Text"));
+        pushLayerUndo("Text");
 
         update();
     }
@@ -1729,51 +1552,13 @@ void Canvas::floodFill(const QPoint &position, const QColor &fillColor)
         return;
     }
 
-    // Get the target color (color to be replaced)
-    QImage image = m_canvas.toImage();
-    QColor targetColor = image.pixelColor(position.x(), position.y());
-
     // If target color is same as fill color, nothing to do
-    if (targetColor == fillColor) {
+    if (m_fillOptions.tolerance == 0 && m_canvas.pixelColor(position) == fillColor) {
         return;
     }
 
-    // Create a mask to identify the region to fill
-    QImage mask(m_document->width(), m_document->height(), QImage::Format_ARGB32);
-    mask.fill(Qt::transparent);
-
-    // Stack-based flood fill algorithm to create the mask
-    QStack<QPoint> stack;
-    stack.push(position);
-
-    while (!stack.isEmpty()) {
-        QPoint currentPoint = stack.pop();
-        int x = currentPoint.x();
-        int y = currentPoint.y();
-
-        // Check bounds
-        if (x < 0 || x >= m_document->width() || y < 0 || y >= m_document->height()) {
-            continue;
-        }
-
-        // Check if this pixel needs to be filled
-        if (image.pixelColor(x, y) != targetColor || mask.pixelColor(x, y) != Qt::transparent) {
-            continue;
-        }
-
-        // Mark this pixel in the mask
-        mask.setPixelColor(x, y, Qt::white);
-
-        // Add neighboring pixels to stack
-        stack.push(QPoint(x + 1, y));     // Right
-        stack.push(QPoint(x - 1, y));     // Left
-        stack.push(QPoint(x, y + 1));     // Down
-        stack.push(QPoint(x, y - 1));     // Up
-    }
-
-    // Now paint the masked region with the selected pattern
-    QPainter painter(&currentLayer().pixmap());
-    painter.setRenderHint(QPainter::Antialiasing, false); // Keep pixels crisp for patterns
+    // The area is found on what is visible and painted on the current layer
+    Unimalen::SpanMask mask = Unimalen::floodFillSpans(m_canvas, position, m_fillOptions);
 
     QBrush patternBrush;
     if (isCustomPattern(m_currentPattern)) {
@@ -1782,23 +1567,9 @@ void Canvas::floodFill(const QPoint &position, const QColor &fillColor)
         Qt::BrushStyle brushStyle = patternTypeToBrushStyle(m_currentPattern);
         patternBrush = QBrush(fillColor, brushStyle);
     }
-    painter.setBrush(patternBrush);
-    painter.setPen(Qt::NoPen);
-
-    // Create a clipping region from the mask
-    QRegion clipRegion;
-    for (int y = 0; y < m_document->height(); ++y) {
-        for (int x = 0; x < m_document->width(); ++x) {
-            if (mask.pixelColor(x, y) == Qt::white) {
-                clipRegion += QRect(x, y, 1, 1);
-            }
-        }
-    }
-
-    painter.setClipRegion(clipRegion);
-    painter.drawRect(0, 0, m_document->width(), m_document->height());
+    Unimalen::fillSpans(currentLayer().image(), mask, patternBrush);
 
-    compositeAllLayers();
+    compositeDirtyRect(mask.boundingRect());
     update();
 }
 
@@ -1835,67 +1606,42 @@ void Canvas::clearSelection()
     m_drawingLasso = false;
     m_draggingSelection = false;
     m_lassoPolygon.clear();
+    m_selection = Unimalen::Selection();
+    m_selectionOverlay = QImage();
+    m_wandSeed = QPoint(-1, -1);
     setCursor(Qt::ArrowCursor);
     update();
 }
 
 void Canvas::cutSelection()
 {
-    if (!m_hasSelection || m_lassoPolygon.isEmpty()) {
+    if (!m_hasSelection || m_selection.isEmpty()) {
         return;
     }
 
     copySelection(); // First copy to clipboard
 
-    // Create a region from the polygon for masking
-    QRegion region(m_lassoPolygon);
-    QImage image = m_canvas.toImage();
-
     // Fill the selected area with white (background color)
-    QPainter painter(&image);
-    painter.setClipRegion(region);
-    painter.fillRect(image.rect(), Qt::white);
+    m_selection.fill(m_canvas, Qt::white);
 
-    m_canvas = QPixmap::fromImage(image);
     clearSelection();
     update();
 }
 
 void Canvas::copySelection()
 {
-    if (!m_hasSelection || m_lassoPolygon.isEmpty()) {
+    if (!m_hasSelection || m_selection.isEmpty()) {
         return;
     }
 
-    // Get bounding rectangle of selection
-    QRect boundingRect = m_lassoPolygon.boundingRect();
-
-    // Create a pixmap of the selected area
-    QPixmap selectedArea = m_canvas.copy(boundingRect);
-
-    // Create a mask from the polygon
-    QPixmap mask(boundingRect.size());
-    mask.fill(Qt::black);
-
-    QPainter maskPainter(&mask);
-    maskPainter.setBrush(Qt::white);
-    maskPainter.setPen(Qt::NoPen);
-
-    // Translate polygon to mask coordinates
-    QPolygon translatedPolygon;
-    for (const QPoint &point : m_lassoPolygon) {
-        translatedPolygon << (point - boundingRect.topLeft());
-    }
-    maskPainter.drawPolygon(translatedPolygon);
-
-    // Apply mask to selected area
-    selectedArea.setMask(mask.createHeuristicMask());
+    // Copy the selected area, masked to the selection
+    QImage selectedArea = m_selection.copy(m_canvas);
 
     // Store in internal clipboard
     m_clipboard = selectedArea;
 
     // Also copy to system clipboard
-    QApplication::clipboard()->setPixmap(selectedArea);
+    QApplication::clipboard()->setImage(selectedArea);
 }
 
 void Canvas::pasteSelection()
@@ -1908,7 +1654,7 @@ void Canvas::pasteSelectionAt(const QPoint &position)
 {
     if (m_clipboard.isNull()) {
         // Try to get from system clipboard
-        m_clipboard = QApplication::clipboard()->pixmap();
+        m_clipboard = QApplication::clipboard()->image();
         if (m_clipboard.isNull()) {
             return;
         }
@@ -1921,8 +1667,8 @@ void Canvas::pasteSelectionAt(const QPoint &position)
     pastePos.setX(qMax(0, qMin(pastePos.x(), m_document->width() - m_clipboard.width())));
     pastePos.setY(qMax(0, qMin(pastePos.y(), m_document->height() - m_clipboard.height())));
 
-    QPainter painter(&currentLayer().pixmap());
-    painter.drawPixmap(pastePos, m_clipboard);
+    QPainter painter(&currentLayer().image());
+    painter.drawImage(pastePos, m_clipboard);
 
     compositeAllLayers();
     update();
@@ -1940,17 +1686,17 @@ void Canvas::rotateSelection(int degrees)
     }
 
     // Handle dragging rectangular selection
-    if (m_rectSelectMode && m_draggingSelection && !m_selectedPixmap.isNull()) {
+    if (m_rectSelectMode && m_draggingSelection && !m_selectedImage.isNull()) {
         QTransform transform;
         transform.rotate(degrees);
-        m_selectedPixmap = m_selectedPixmap.transformed(transform, Qt::SmoothTransformation);
+        m_selectedImage = m_selectedImage.transformed(transform, Qt::SmoothTransformation);
 
         // Update selection offset to keep it centered
         if (degrees == 90 || degrees == 270) {
             // Swap width/height, adjust position
-            QRect oldRect = QRect(m_selectionOffset, m_selectedPixmap.size());
+            QRect oldRect = QRect(m_selectionOffset, m_selectedImage.size());
             QPoint center = oldRect.center();
-            m_selectionOffset = center - QPoint(m_selectedPixmap.width() / 2, m_selectedPixmap.height() / 2);
+            m_selectionOffset = center - QPoint(m_selectedImage.width() / 2, m_selectedImage.height() / 2);
         }
 
         update();
@@ -1958,41 +1704,23 @@ void Canvas::rotateSelection(int degrees)
     }
 
     // Handle lasso selection
-    if (m_lassoMode && m_hasSelection && !m_lassoPolygon.isEmpty()) {
-        // Get the selection content
-        QRect boundingRect = m_lassoPolygon.boundingRect();
-        QPixmap selectedArea = m_canvas.copy(boundingRect);
-
-        // Create mask from polygon
-        QPixmap mask(boundingRect.size());
-        mask.fill(Qt::black);
-        QPainter maskPainter(&mask);
-        maskPainter.setBrush(Qt::white);
-        maskPainter.setPen(Qt::NoPen);
-
-        QPolygon translatedPolygon;
-        for (const QPoint &point : m_lassoPolygon) {
-            translatedPolygon << (point - boundingRect.topLeft());
-        }
-        maskPainter.drawPolygon(translatedPolygon);
-
-        // Apply mask and rotate
-        selectedArea.setMask(mask.createHeuristicMask());
+    if (m_lassoMode && m_hasSelection && !m_selection.isEmpty()) {
+        // Get the selection content and rotate it
+        QRect boundingRect = m_selection.boundingRect();
+        QImage selectedArea = m_selection.copy(m_canvas);
         QTransform transform;
         transform.rotate(degrees);
-        QPixmap rotated = selectedArea.transformed(transform, Qt::SmoothTransformation);
+        QImage rotated = selectedArea.transformed(transform, Qt::SmoothTransformation);
 
         // Clear original selection area
-        QPainter painter(&currentLayer().pixmap());
-        painter.setCompositionMode(QPainter::CompositionMode_Source);
-        painter.setClipRegion(QRegion(m_lassoPolygon));
-        painter.fillRect(boundingRect, Qt::white);
+        m_selection.fill(currentLayer().image(), Qt::white);
 
         // Draw rotated selection back
+        QPainter painter(&currentLayer().image());
         QPoint center = boundingRect.center();
         QPoint newTopLeft = center - QPoint(rotated.width() / 2, rotated.height() / 2);
-        painter.setClipRegion(QRegion());
-        painter.drawPixmap(newTopLeft, rotated);
+        painter.drawImage(newTopLeft, rotated);
+        painter.end();
 
         compositeAllLayers();
         clearSelection();
@@ -2003,41 +1731,25 @@ void Canvas::rotateSelection(int degrees)
 void Canvas::flipSelectionHorizontal()
 {
     // Handle dragging rectangular selection
-    if (m_rectSelectMode && m_draggingSelection && !m_selectedPixmap.isNull()) {
-        m_selectedPixmap = m_selectedPixmap.transformed(QTransform().scale(-1, 1), Qt::SmoothTransformation);
+    if (m_rectSelectMode && m_draggingSelection && !m_selectedImage.isNull()) {
+        m_selectedImage = m_selectedImage.transformed(QTransform().scale(-1, 1), Qt::SmoothTransformation);
         update();
         return;
     }
 
     // Handle lasso selection
-    if (m_lassoMode && m_hasSelection && !m_lassoPolygon.isEmpty()) {
-        QRect boundingRect = m_lassoPolygon.boundingRect();
-        QPixmap selectedArea = m_canvas.copy(boundingRect);
-
-        // Create and apply mask
-        QPixmap mask(boundingRect.size());
-        mask.fill(Qt::black);
-        QPainter maskPainter(&mask);
-        maskPainter.setBrush(Qt::white);
-        maskPainter.setPen(Qt::NoPen);
-
-        QPolygon translatedPolygon;
-        for (const QPoint &point : m_lassoPolygon) {
-            translatedPolygon << (point - boundingRect.topLeft());
-        }
-        maskPainter.drawPolygon(translatedPolygon);
-        selectedArea.setMask(mask.createHeuristicMask());
+    if (m_lassoMode && m_hasSelection && !m_selection.isEmpty()) {
+        QRect boundingRect = m_selection.boundingRect();
+        QImage selectedArea = m_selection.copy(m_canvas);
 
         // Flip horizontally
-        QPixmap flipped = selectedArea.transformed(QTransform().scale(-1, 1), Qt::SmoothTransformation);
+        QImage flipped = selectedArea.transformed(QTransform().scale(-1, 1), Qt::SmoothTransformation);
 
         // Clear and redraw
-        QPainter painter(&currentLayer().pixmap());
-        painter.setCompositionMode(QPainter::CompositionMode_Source);
-        painter.setClipRegion(QRegion(m_lassoPolygon));
-        painter.fillRect(boundingRect, Qt::white);
-        painter.setClipRegion(QRegion());
-        painter.drawPixmap(boundingRect.topLeft(), flipped);
+        m_selection.fill(currentLayer().image(), Qt::white);
+        QPainter painter(&currentLayer().image());
+        painter.drawImage(boundingRect.topLeft(), flipped);
+        painter.end();
 
         compositeAllLayers();
         clearSelection();
@@ -2048,41 +1760,25 @@ void Canvas::flipSelectionHorizontal()
 void Canvas::flipSelectionVertical()
 {
     // Handle dragging rectangular selection
-    if (m_rectSelectMode && m_draggingSelection && !m_selectedPixmap.isNull()) {
-        m_selectedPixmap = m_selectedPixmap.transformed(QTransform().scale(1, -1), Qt::SmoothTransformation);
+    if (m_rectSelectMode && m_draggingSelection && !m_selectedImage.isNull()) {
+        m_selectedImage = m_selectedImage.transformed(QTransform().scale(1, -1), Qt::SmoothTransformation);
         update();
         return;
     }
 
     // Handle lasso selection
-    if (m_lassoMode && m_hasSelection && !m_lassoPolygon.isEmpty()) {
-        QRect boundingRect = m_lassoPolygon.boundingRect();
-        QPixmap selectedArea = m_canvas.copy(boundingRect);
-
-        // Create and apply mask
-        QPixmap mask(boundingRect.size());
-        mask.fill(Qt::black);
-        QPainter maskPainter(&mask);
-        maskPainter.setBrush(Qt::white);
-        maskPainter.setPen(Qt::NoPen);
-
-        QPolygon translatedPolygon;
-        for (const QPoint &point : m_lassoPolygon) {
-            translatedPolygon << (point - boundingRect.topLeft());
-        }
-        maskPainter.drawPolygon(translatedPolygon);
-        selectedArea.setMask(mask.createHeuristicMask());
+    if (m_lassoMode && m_hasSelection && !m_selection.isEmpty()) {
+        QRect boundingRect = m_selection.boundingRect();
+        QImage selectedArea = m_selection.copy(m_canvas);
 
         // Flip vertically
-        QPixmap flipped = selectedArea.transformed(QTransform().scale(1, -1), Qt::SmoothTransformation);
+        QImage flipped = selectedArea.transformed(QTransform().scale(1, -1), Qt::SmoothTransformation);
 
         // Clear and redraw
-        QPainter painter(&currentLayer().pixmap());
-        painter.setCompositionMode(QPainter::CompositionMode_Source);
-        painter.setClipRegion(QRegion(m_lassoPolygon));
-        painter.fillRect(boundingRect, Qt::white);
-        painter.setClipRegion(QRegion());
-        painter.drawPixmap(boundingRect.topLeft(), flipped);
+        m_selection.fill(currentLayer().image(), Qt::white);
+        QPainter painter(&currentLayer().image());
+        painter.drawImage(boundingRect.topLeft(), flipped);
+        painter.end();
 
         compositeAllLayers();
         clearSelection();
@@ -2090,17 +1786,17 @@ void Canvas::flipSelectionVertical()
     }
 }
 
-void Canvas::insertImageAt(const QPixmap &image, const QPoint &position)
+void Canvas::insertImageAt(const QImage &image, const QPoint &position)
 {
     if (image.isNull()) {
         return;
     }
 
-    // Save canvas state for undo
-    QPixmap canvasBeforeInsert = m_canvas;
+    // Save layer state for undo
+    saveCanvasState();
 
     // Scale image if it's larger than the canvas
-    QPixmap scaledImage = image;
+    QImage scaledImage = image;
     int maxWidth = m_document->width();
     int maxHeight = m_document->height();
 
@@ -2116,14 +1812,14 @@ void Canvas::insertImageAt(const QPixmap &image, const QPoint &position)
     insertPos.setY(qMax(0, qMin(insertPos.y(), m_document->height() - scaledImage.height())));
 
     // Draw the image onto the current layer
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
     painter.setRenderHint(QPainter::SmoothPixmapTransform);
-    painter.drawPixmap(insertPos, scaledImage);
+    painter.drawImage(insertPos, scaledImage);
 
     compositeAllLayers();
 
     // Create undo command for image insertion
-    m_undoStack->push(new CanvasUndoCommand(this, canvasBeforeInsert, m_canvas, "Insert Image"));
+    pushLayerUndo("Insert Image");
 
     update();
 }
@@ -2134,14 +1830,14 @@ void Canvas::contextMenuEvent(QContextMenuEvent *event)
 
     // Add Cut action (only if there's a selection)
     QAction *cutAction = nullptr;
-    if (m_hasSelection && !m_lassoPolygon.isEmpty()) {
+    if (m_hasSelection && !m_selection.isEmpty()) {
         cutAction = contextMenu.addAction("Cut");
         connect(cutAction, &QAction::triggered, this, &Canvas::cutSelection);
     }
 
     // Add Copy action (only if there's a selection)
     QAction *copyAction = nullptr;
-    if (m_hasSelection && !m_lassoPolygon.isEmpty()) {
+    if (m_hasSelection && !m_selection.isEmpty()) {
         copyAction = contextMenu.addAction("Copy");
         connect(copyAction, &QAction::triggered, this, &Canvas::copySelection);
     }
@@ -2153,7 +1849,7 @@ void Canvas::contextMenuEvent(QContextMenuEvent *event)
 
     // Add Paste action (if clipboard has content)
     QAction *pasteAction = nullptr;
-    if (!m_clipboard.isNull() || !QApplication::clipboard()->pixmap().isNull()) {
+    if (!m_clipboard.isNull() || !QApplication::clipboard()->image().isNull()) {
         pasteAction = contextMenu.addAction("Paste Here");
         // Capture the position now, before the lambda is executed
         QPoint clickPos = mapToCanvas(event->pos());
@@ -2170,7 +1866,7 @@ void Canvas::contextMenuEvent(QContextMenuEvent *event)
 
 void Canvas::drawStraightLine(const QPoint &startPoint, const QPoint &endPoint)
 {
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
 
     if (m_currentPattern == PatternBar::Solid) {
         // For solid pattern, use regular line drawing
@@ -2217,7 +1913,7 @@ void Canvas::drawStraightLine(const QPoint &startPoint, const QPoint &endPoint)
 
 void Canvas::drawBezierCurve(const QPoint &p0, const QPoint &p1, const QPoint &p2, const QPoint &p3)
 {
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
 
     // Create bezier curve path
     QPainterPath path;
@@ -2265,7 +1961,7 @@ void Canvas::drawBezierCurve(const QPoint &p0, const QPoint &p1, const QPoint &p
 
 void Canvas::drawSquare(const QPoint &startPoint, const QPoint &endPoint, bool filled)
 {
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
     painter.setPen(QPen(m_currentColor, 2, Qt::SolidLine));
 
     if (filled) {
@@ -2300,7 +1996,7 @@ void Canvas::drawSquare(const QPoint &startPoint, const QPoint &endPoint, bool f
 
 void Canvas::drawRoundedSquare(const QPoint &startPoint, const QPoint &endPoint, bool filled)
 {
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
     painter.setPen(QPen(m_currentColor, 2, Qt::SolidLine));
     painter.setRenderHint(QPainter::Antialiasing);
 
@@ -2343,7 +2039,7 @@ void Canvas::drawRoundedSquare(const QPoint &startPoint, const QPoint &endPoint,
 
 void Canvas::drawOval(const QPoint &startPoint, const QPoint &endPoint, bool filled)
 {
-    QPainter painter(&currentLayer().pixmap());
+    QPainter painter(&currentLayer().image());
     painter.setPen(QPen(m_currentColor, 2, Qt::SolidLine));
     painter.setRenderHint(QPainter::Antialiasing);
 
@@ -2431,17 +2127,17 @@ bool Canvas::isCustomPattern(PatternBar::PatternType pattern)
 
 QBrush Canvas::createCustomPatternBrush(PatternBar::PatternType pattern)
 {
-    // Create a higher resolution pattern pixmap for better quality
-    QPixmap patternPixmap(64, 64);
-    patternPixmap.fill(Qt::white);
+    // Create a higher resolution pattern image for better quality
+    QImage patternImage(64, 64, QImage::Format_ARGB32_Premultiplied);
+    patternImage.fill(Qt::white);
 
-    QPainter painter(&patternPixmap);
+    QPainter painter(&patternImage);
     painter.setRenderHint(QPainter::Antialiasing, true);
     painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
     painter.setPen(QPen(m_currentColor, 1));
     drawCustomPattern(painter, pattern, 0, 0, 64, 64);
 
-    return QBrush(patternPixmap);
+    return QBrush(patternImage);
 }
 
 void Canvas::drawCustomPattern(QPainter &painter, PatternBar::PatternType type, int x, int y, int width, int height)
@@ -2643,24 +2339,174 @@ void Canvas::drawCustomPattern(QPainter &painter, PatternBar::PatternType type,
 // Undo/Redo system implementation
 void Canvas::saveCanvasState()
 {
-    // This is called before an operation to save the current state
-    // The actual undo command is created in the drawing operations
+    // This is called before an operation to save the current state.
+    // Taking the tiles is cheap as they are shared with the layer; the
+    // undo command is created in the drawing operations by pushLayerUndo()
+    m_editLayerId = currentLayer().id();
+    m_tilesBeforeEdit = currentLayer().tiles();
 }
 
-void Canvas::setCanvasPixmap(const QPixmap &pixmap)
+void Canvas::pushLayerUndo(const QString &text)
 {
-    m_canvas = pixmap;
+    Unimalen::LayerTilesCommand *command =
+        new Unimalen::LayerTilesCommand(m_document, m_editLayerId, m_tilesBeforeEdit, text);
+    m_tilesBeforeEdit.clear();
+
+    if (command->isEmpty()) {
+        delete command;
+        return;
+    }
+    m_undoStack->push(command);
+    recordRecovery(command);
+    Unimalen::enforceUndoBudget(m_undoStack, m_undoBudget, &m_undoJournal);
+}
+
+void Canvas::setWandTolerance(int tolerance)
+{
+    m_wandTolerance = tolerance;
+    if (m_magicWandMode && m_hasSelection && !m_draggingSelection && m_wandSeed.x() >= 0) {
+        magicWandSelect(m_wandSeed);
+    }
+}
+
+void Canvas::magicWandSelect(const QPoint &seed)
+{
+    // Matched in premultiplied form, the same as the fill tool. Read through
+    // the const layer, image() would mark it edited on every tolerance change.
+    const Layer &layer = static_cast<const Canvas*>(this)->currentLayer();
+    const QImage image = layer.toImage();
+    if (!image.rect().contains(seed)) {
+        clearSelection();
+        return;
+    }
+
+    Unimalen::SpanMask mask;
+    if (m_wandContiguous) {
+        Unimalen::FillOptions options;
+        options.tolerance = m_wandTolerance;
+        mask = Unimalen::floodFillSpans(image, seed, options);
+    } else {
+        QRgb target = reinterpret_cast<const QRgb*>(image.constScanLine(seed.y()))[seed.x()];
+        mask = Unimalen::selectColor(image, target, m_wandTolerance);
+    }
+
+    m_lassoPolygon.clear();
+    m_selection = Unimalen::Selection::fromSpans(mask);
+    m_hasSelection = !m_selection.isEmpty();
+    m_wandSeed = seed;
+
+    m_selectionOverlay = QImage(m_selection.coverage().size(), QImage::Format_ARGB32_Premultiplied);
+    m_selectionOverlay.fill(QColor(0, 120, 215, 80));
+    QPainter painter(&m_selectionOverlay);
+    painter.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+    painter.drawImage(0, 0, m_selection.coverage());
+    painter.end();
+
     update();
 }
 
+void Canvas::setUndoBudget(qint64 bytes)
+{
+    m_undoBudget = bytes;
+    Unimalen::enforceUndoBudget(m_undoStack, m_undoBudget, &m_undoJournal);
+    // Flattened pages get a quarter of the same budget
+    m_document->setCompositeCacheBudget(bytes / 4);
+}
+
 void Canvas::undo()
 {
     m_undoStack->undo();
+    recordRecovery(m_undoStack->command(m_undoStack->index()));
+    Unimalen::enforceUndoBudget(m_undoStack, m_undoBudget, &m_undoJournal);
+    compositeAllLayers();
+    emit layersChanged();
+    update();
 }
 
 void Canvas::redo()
 {
     m_undoStack->redo();
+    recordRecovery(m_undoStack->command(m_undoStack->index() - 1));
+    Unimalen::enforceUndoBudget(m_undoStack, m_undoBudget, &m_undoJournal);
+    compositeAllLayers();
+    emit layersChanged();
+    update();
+}
+
+void Canvas::setRecoveryDirectory(const QString &directory)
+{
+    // An empty directory turns journaling off
+    m_recoveryJournal.setBasePath(directory.isEmpty() ? QString() : directory + "/" + m_autoSaveId);
+}
+
+void Canvas::checkpointRecovery()
+{
+    int segment = m_recoveryJournal.startSegment(*m_document);
+    if (segment < 0) {
+        return;
+    }
+
+    // The snapshot shares tiles with the document, the checkpoint is
+    // encoded and written off the GUI thread
+    QString basePath = m_recoveryJournal.basePath();
+    Document snapshot = m_document->snapshot();
+    QThreadPool::globalInstance()->start([basePath, segment, snapshot]() {
+        Unimalen::RecoveryJournal::writeCheckpoint(basePath, segment, snapshot);
+    });
+}
+
+void Canvas::recordRecovery(const QUndoCommand *command)
+{
+    const Unimalen::LayerTilesCommand *tilesCommand = dynamic_cast<const Unimalen::LayerTilesCommand*>(command);
+    if (!tilesCommand || m_recoveryJournal.basePath().isEmpty()) {
+        return;
+    }
+
+    // Deltas refer to layers by id, so layer or page changes since the
+    // last checkpoint need a new one instead
+    const Layer *layer = m_document->findLayer(tilesCommand->layerId());
+    if (!layer || !m_recoveryJournal.hasStructure(*m_document)) {
+        checkpointRecovery();
+        return;
+    }
+    if (!m_recoveryJournal.appendTiles(*layer, tilesCommand->changedTiles())) {
+        checkpointRecovery();
+    }
+}
+
+void Canvas::compactRecovery()
+{
+    if (!m_isModified || m_recoveryJournal.basePath().isEmpty()) {
+        return;
+    }
+    if (!m_recoveryJournal.isInSync(*m_document)
+        || m_recoveryJournal.segmentBytes() > Unimalen::RECOVERY_COMPACT_BYTES) {
+        checkpointRecovery();
+    }
+}
+
+bool Canvas::recoverFrom(const QString &basePath)
+{
+    Document recovered;
+    if (!Unimalen::RecoveryJournal::replay(basePath, recovered)) {
+        return false;
+    }
+
+    m_undoStack->clear();
+    m_undoJournal.reset();
+    *m_document = recovered;
+    m_document->setCompositeCacheBudget(m_undoBudget / 4);
+
+    compositeAllLayers();
+    updateCanvasSize();
+    setModified(true);
+    emit layersChanged();
+    emit currentLayerChanged(m_document->currentLayerIndex());
+    update();
+
+    // Make the recovered state durable under this canvas right away
+    checkpointRecovery();
+    return true;
 }
 
 bool Canvas::canUndo() const
@@ -2680,10 +2526,10 @@ QUndoStack* Canvas::undoStack() const
 
 bool Canvas::isPointInSelection(const QPoint &point) const
 {
-    if (!m_hasSelection || m_lassoPolygon.isEmpty()) {
+    if (!m_hasSelection) {
         return false;
     }
-    return m_lassoPolygon.containsPoint(point, Qt::OddEvenFill);
+    return m_selection.contains(point);
 }
 
 void Canvas::setPixelZoomMode(bool enabled)
@@ -2696,6 +2542,37 @@ void Canvas::setPixelZoomMode(bool enabled)
     update();
 }
 
+void Canvas::setMagnifierPixels(int pixels)
+{
+    // Odd, so the zoom center has a cell in the middle
+    m_magnifierPixels = qBound(5, pixels | 1, 75);
+    update();
+}
+
+int Canvas::magnifierCellSize() const
+{
+    return qMax(1, (m_magnifierRadius * 2) / m_magnifierPixels);
+}
+
+QPoint Canvas::magnifierGridOrigin() const
+{
+    // Top left of the grid, placed so the center cell sits on the magnifier center
+    int pixelSize = magnifierCellSize();
+    int halfExtent = (m_magnifierPixels / 2) * pixelSize + pixelSize / 2;
+    return m_magnifierPosition - QPoint(halfExtent, halfExtent);
+}
+
+QPoint Canvas::magnifierPixelAt(const QPoint &widgetPos) const
+{
+    int pixelSize = magnifierCellSize();
+    QPoint relative = widgetPos - magnifierGridOrigin();
+    int halfVisible = m_magnifierPixels / 2;
+    // Floor division, the grid can start outside the clip circle
+    int cellX = relative.x() >= 0 ? relative.x() / pixelSize : -((-relative.x() + pixelSize - 1) / pixelSize);
+    int cellY = relative.y() >= 0 ? relative.y() / pixelSize : -((-relative.y() + pixelSize - 1) / pixelSize);
+    return m_zoomCenter + QPoint(cellX - halfVisible, cellY - halfVisible);
+}
+
 void Canvas::movePixelCursor(int dx, int dy)
 {
     if (!m_pixelZoomMode) return;
@@ -2815,7 +2692,7 @@ void Canvas::setLayerVisibility(int index, bool visible)
 void Canvas::setLayerOpacity(int index, qreal opacity)
 {
     m_document->setLayerOpacity(index, opacity);
-    compositeAllLayers();
+    compositeDirtyRect(m_canvas.rect()); // Only three surfaces while scrubbing
     emit layersChanged();
     update();
 }
@@ -2823,7 +2700,7 @@ void Canvas::setLayerOpacity(int index, qreal opacity)
 void Canvas::setLayerBlendMode(int index, Layer::BlendMode mode)
 {
     m_document->setLayerBlendMode(index, mode);
-    compositeAllLayers();
+    compositeDirtyRect(m_canvas.rect());
     emit layersChanged();
     update();
 }
@@ -2836,7 +2713,23 @@ void Canvas::setLayerName(int index, const QString &name)
 
 void Canvas::compositeAllLayers()
 {
+    // Served from the document's composite cache when the page is unchanged
     m_canvas = m_document->composite();
+    m_prefetchTimer->start();
+}
+
+void Canvas::prefetchAdjacentPages()
+{
+    int current = m_document->currentPageIndex();
+    m_document->prefetchComposite(current + 1);
+    m_document->prefetchComposite(current - 1);
+}
+
+void Canvas::compositeDirtyRect(const QRect &rect)
+{
+    // Only the damaged area of the existing buffer is re-blended, so stroke
+    // cost scales with the brush size rather than the page size
+    m_document->compositeRect(m_canvas, rect);
 }
 
 void Canvas::updateCanvasSize()
@@ -2852,9 +2745,8 @@ void Canvas::performScissorsCut(const QPolygon &cutLine)
         return;
     }
 
-    // Get the current layer pixmap
-    QPixmap layerPixmap = currentLayer().pixmap();
-    QImage layerImage = layerPixmap.toImage();
+    // Get the current layer pixels
+    QImage layerImage = currentLayer().image();
 
     // Create a thick cutting line path (scissors blade width)
     QPainterPath cutPath;
@@ -2868,96 +2760,39 @@ void Canvas::performScissorsCut(const QPolygon &cutLine)
 
     QPainterPath thickCutPath = stroker.createStroke(cutPath);
 
-    // Determine which side is "left" and which is "right" of the cut
-    // We'll use a flood fill approach from opposite corners
+    // Everything the blade does not cover falls apart into connected
+    // pieces; the ones at the top-left and bottom-right corners are cut out
     QRect bounds = layerImage.rect();
-
-    // Create masks for both regions
-    QImage mask1(bounds.size(), QImage::Format_ARGB32);
-    QImage mask2(bounds.size(), QImage::Format_ARGB32);
-    mask1.fill(Qt::transparent);
-    mask2.fill(Qt::transparent);
-
-    // Paint the cut path onto a mask
-    QImage cutMask(bounds.size(), QImage::Format_ARGB32);
-    cutMask.fill(Qt::transparent);
+    QImage cutMask(bounds.size(), QImage::Format_Alpha8);
+    cutMask.fill(0);
     QPainter cutPainter(&cutMask);
     cutPainter.fillPath(thickCutPath, Qt::white);
+    cutPainter.end();
 
-    // Flood fill from top-left for region 1
-    QStack<QPoint> stack1;
-    stack1.push(QPoint(0, 0));
-    while (!stack1.isEmpty()) {
-        QPoint p = stack1.pop();
-        if (p.x() < 0 || p.x() >= bounds.width() || p.y() < 0 || p.y() >= bounds.height()) continue;
-        if (mask1.pixelColor(p) != Qt::transparent) continue;
-        if (cutMask.pixelColor(p).alpha() > 0) continue;
-
-        mask1.setPixelColor(p, Qt::white);
-        stack1.push(QPoint(p.x() + 1, p.y()));
-        stack1.push(QPoint(p.x() - 1, p.y()));
-        stack1.push(QPoint(p.x(), p.y() + 1));
-        stack1.push(QPoint(p.x(), p.y() - 1));
-    }
-
-    // Flood fill from bottom-right for region 2
-    QStack<QPoint> stack2;
-    stack2.push(QPoint(bounds.width() - 1, bounds.height() - 1));
-    while (!stack2.isEmpty()) {
-        QPoint p = stack2.pop();
-        if (p.x() < 0 || p.x() >= bounds.width() || p.y() < 0 || p.y() >= bounds.height()) continue;
-        if (mask2.pixelColor(p) != Qt::transparent) continue;
-        if (cutMask.pixelColor(p).alpha() > 0) continue;
-        if (mask1.pixelColor(p) != Qt::transparent) continue;
-
-        mask2.setPixelColor(p, Qt::white);
-        stack2.push(QPoint(p.x() + 1, p.y()));
-        stack2.push(QPoint(p.x() - 1, p.y()));
-        stack2.push(QPoint(p.x(), p.y() + 1));
-        stack2.push(QPoint(p.x(), p.y() - 1));
-    }
-
-    // Create pixmaps for both pieces
-    m_scissorsPiece1 = QPixmap(bounds.size());
-    m_scissorsPiece2 = QPixmap(bounds.size());
-    m_scissorsPiece1.fill(Qt::transparent);
-    m_scissorsPiece2.fill(Qt::transparent);
-
-    // Extract pixels for each piece
-    QImage piece1 = m_scissorsPiece1.toImage();
-    QImage piece2 = m_scissorsPiece2.toImage();
-
+    QVector<quint8> open(qsizetype(bounds.width()) * bounds.height());
     for (int y = 0; y < bounds.height(); ++y) {
+        const uchar *line = cutMask.constScanLine(y);
+        quint8 *out = open.data() + qsizetype(y) * bounds.width();
         for (int x = 0; x < bounds.width(); ++x) {
-            if (mask1.pixelColor(x, y).alpha() > 0) {
-                piece1.setPixelColor(x, y, layerImage.pixelColor(x, y));
-            }
-            if (mask2.pixelColor(x, y).alpha() > 0) {
-                piece2.setPixelColor(x, y, layerImage.pixelColor(x, y));
-            }
+            out[x] = line[x] == 0;
         }
     }
+    Unimalen::ConnectedComponents components(open, bounds.width(), bounds.height());
 
-    m_scissorsPiece1 = QPixmap::fromImage(piece1);
-    m_scissorsPiece2 = QPixmap::fromImage(piece2);
-
-    // Create regions from masks
-    m_scissorsRegion1 = QRegion();
-    m_scissorsRegion2 = QRegion();
-
-    for (int y = 0; y < bounds.height(); ++y) {
-        for (int x = 0; x < bounds.width(); ++x) {
-            if (mask1.pixelColor(x, y).alpha() > 0) {
-                m_scissorsRegion1 += QRect(x, y, 1, 1);
-            }
-            if (mask2.pixelColor(x, y).alpha() > 0) {
-                m_scissorsRegion2 += QRect(x, y, 1, 1);
-            }
-        }
+    int label1 = components.labelAt(0, 0);
+    int label2 = components.labelAt(bounds.width() - 1, bounds.height() - 1);
+    if (label2 == label1) {
+        label2 = 0;
     }
+    m_scissorsMask1 = components.mask(label1);
+    m_scissorsMask2 = components.mask(label2);
+
+    // Pieces are cropped to their own bounds rather than page-sized
+    m_scissorsPiece1 = Unimalen::cropToMask(layerImage, m_scissorsMask1);
+    m_scissorsPiece2 = Unimalen::cropToMask(layerImage, m_scissorsMask2);
 
     // Clear the current layer
-    currentLayer().pixmap().fill(Qt::transparent);
+    currentLayer().image().fill(Qt::transparent);
 
     // Initialize piece offsets
     m_piece1Offset = QPoint(0, 0);
@@ -2968,10 +2803,36 @@ void Canvas::performScissorsCut(const QPolygon &cutLine)
     update();
 }
 
+void Canvas::commitScissorsPieces()
+{
+    QPainter painter(&currentLayer().image());
+    painter.setRenderHint(QPainter::Antialiasing, false);
+
+    painter.drawImage(m_scissorsMask1.boundingRect().topLeft() + m_piece1Offset, m_scissorsPiece1);
+    painter.drawImage(m_scissorsMask2.boundingRect().topLeft() + m_piece2Offset, m_scissorsPiece2);
+    painter.end();
+
+    // Clear scissors state
+    m_hasScissorsPieces = false;
+    m_draggingPiece1 = false;
+    m_draggingPiece2 = false;
+    m_scissorsPiece1 = QImage();
+    m_scissorsPiece2 = QImage();
+    m_scissorsMask1 = Unimalen::SpanMask();
+    m_scissorsMask2 = Unimalen::SpanMask();
+
+    compositeAllLayers();
+    update();
+}
+
 void Canvas::setModified(bool modified)
 {
     if (m_isModified != modified) {
         m_isModified = modified;
+        if (!modified) {
+            // Saved or freshly loaded, the file on disk is the recovery point
+            m_recoveryJournal.discard();
+        }
         emit documentModified();
     }
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <QWidget>
 #include <QPixmap>
+#include <QImage>
 #include <QPainter>
 #include <QMouseEvent>
 #include <QKeyEvent>
@@ -14,9 +15,14 @@
 #include <QPainterPathStroker>
 #include <QUndoStack>
 #include <QUndoCommand>
+#include <QTimer>
 #include "patternbar.h"
 #include "core/Layer.h"
 #include "core/Document.h"
+#include "core/UndoJournal.h"
+#include "core/RecoveryJournal.h"
+#include "core/FloodFill.h"
+#include "core/Selection.h"
 
 using Unimalen::Layer;
 using Unimalen::Document;
@@ -34,6 +40,7 @@ signals:
 
 public:
     explicit Canvas(QWidget *parent = nullptr);
+    ~Canvas() override;
 
     void setScaleFactor(int factor);
     void setZoomLevel(double zoomPercent); // New: support arbitrary zoom levels
@@ -43,6 +50,8 @@ public:
     bool isPixelZoomMode() const { return m_pixelZoomMode; }
     void movePixelCursor(int dx, int dy);
     void setZoomCenter(const QPoint &center);
+    void setMagnifierPixels(int pixels); // Width of the magnifier grid in page pixels
+    int magnifierPixels() const { return m_magnifierPixels; }
     void setShowCoordinates(bool show);
     bool isShowCoordinates() const { return m_showCoordinates; }
 
@@ -74,9 +83,14 @@ public:
     void setFillMode(bool enabled) { m_fillMode = enabled; m_pencilMode = false; m_textMode = false; m_sprayMode = false; m_brushMode = false; m_markerMode = false; m_eraserMode = false; m_lineMode = false; m_lassoMode = false; m_squareMode = false; m_filledSquareMode = false; m_roundedSquareMode = false; m_filledRoundedSquareMode = false; m_ovalMode = false; m_filledOvalMode = false; m_bezierMode = false; m_showLinePreview = false; clearSelection(); }
     bool isFillMode() const { return m_fillMode; }
 
-    void setLassoMode(bool enabled) { m_lassoMode = enabled; m_pencilMode = false; m_textMode = false; m_sprayMode = false; m_brushMode = false; m_markerMode = false; m_eraserMode = false; m_lineMode = false; m_fillMode = false; m_squareMode = false; m_filledSquareMode = false; m_roundedSquareMode = false; m_filledRoundedSquareMode = false; m_ovalMode = false; m_filledOvalMode = false; m_bezierMode = false; m_showLinePreview = false; clearSelection(); }
+    void setLassoMode(bool enabled) { m_lassoMode = enabled; m_magicWandMode = false; m_pencilMode = false; m_textMode = false; m_sprayMode = false; m_brushMode = false; m_markerMode = false; m_eraserMode = false; m_lineMode = false; m_fillMode = false; m_squareMode = false; m_filledSquareMode = false; m_roundedSquareMode = false; m_filledRoundedSquareMode = false; m_ovalMode = false; m_filledOvalMode = false; m_bezierMode = false; m_showLinePreview = false; clearSelection(); }
     bool isLassoMode() const { return m_lassoMode; }
 
+    // Magic wand (contiguous) and select by color are lasso modes that pick by color
+    void setMagicWandMode(bool enabled, bool contiguous) { setLassoMode(enabled); m_magicWandMode = enabled; m_wandContiguous = contiguous; }
+    bool isMagicWandMode() const { return m_magicWandMode; }
+    void setWandTolerance(int tolerance); // Re-evaluates the current wand selection
+
     void setSquareMode(bool enabled) { m_squareMode = enabled; m_pencilMode = false; m_textMode = false; m_sprayMode = false; m_brushMode = false; m_markerMode = false; m_eraserMode = false; m_lineMode = false; m_fillMode = false; m_lassoMode = false; m_filledSquareMode = false; m_roundedSquareMode = false; m_filledRoundedSquareMode = false; m_ovalMode = false; m_filledOvalMode = false; m_bezierMode = false; m_showLinePreview = false; clearSelection(); }
     bool isSquareMode() const { return m_squareMode; }
 
@@ -119,7 +133,7 @@ public:
     void flipSelectionVertical();
 
     // Image insertion
-    void insertImageAt(const QPixmap &image, const QPoint &position);
+    void insertImageAt(const QImage &image, const QPoint &position);
 
     void setTextFont(const QString &fontFamily);
     void setTextFontSize(int fontSize);
@@ -157,10 +171,17 @@ public:
     bool canUndo() const;
     bool canRedo() const;
     QUndoStack* undoStack() const;
-    void setCanvasPixmap(const QPixmap &pixmap);
+    void setUndoBudget(qint64 bytes); // Older steps are compressed, then spilled to disk beyond this
+    void setFillOptions(const Unimalen::FillOptions &options) { m_fillOptions = options; }
+
+    // Crash recovery, edits are journaled as they are pushed
+    void setRecoveryDirectory(const QString &directory);
+    void compactRecovery(); // Checkpoint if the journal grew large or missed edits
+    bool recoverFrom(const QString &basePath);
 
     // Compositing (public for MainWindow access)
-    void compositeAllLayers();
+    void compositeAllLayers(); // Also schedules prefetching the neighbouring pages
+    void compositeDirtyRect(const QRect &rect); // Re-blend only the damaged area (canvas coordinates)
 
     // Multi-page support
     void updateCanvasSize();
@@ -169,6 +190,7 @@ public:
     bool isModified() const { return m_isModified; }
     void setModified(bool modified);
     QString filePath() const { return m_filePath; }
+    QString autoSaveId() const { return m_autoSaveId; } // Names the recovery files of this canvas
 
 protected:
     void paintEvent(QPaintEvent *event) override;
@@ -194,6 +216,7 @@ private:
     void startTextInput(const QPoint &position);
     void sprayPaint(const QPoint &position);
     void performScissorsCut(const QPolygon &cutLine);
+    void commitScissorsPieces(); // Paint the pieces back at their offsets
     void brushPaint(const QPoint &position);
     void markerPaint(const QPoint &position);
     void eraserPaint(const QPoint &position);
@@ -210,7 +233,7 @@ private:
     static constexpr int CANVAS_HEIGHT = 720;
     static constexpr int DPI = 72;
 
-    QPixmap m_canvas;
+    QImage m_canvas; // Composite of the current page, converted for display only in paintEvent
     Document* m_document;
     int m_scaleFactor;
     double m_zoomLevel; // New: arbitrary zoom level (percentage, 100.0 = 100%)
@@ -221,6 +244,10 @@ private:
     QPoint m_zoomCenter;
     int m_magnifierRadius;
     QPoint m_magnifierPosition;
+    int m_magnifierPixels; // Odd
+    int magnifierCellSize() const;
+    QPoint magnifierGridOrigin() const;
+    QPoint magnifierPixelAt(const QPoint &widgetPos) const;
     bool m_drawingInMagnifier;
     bool m_showCoordinates;
     QPoint m_mousePosition;
@@ -235,6 +262,7 @@ private:
     bool m_eraserMode;
     bool m_lineMode;
     bool m_fillMode;
+    Unimalen::FillOptions m_fillOptions; // Color tolerance and gap closing
     bool m_lassoMode;
     bool m_rectSelectMode;
     bool m_eyedropperMode;
@@ -269,10 +297,10 @@ private:
     QPolygon m_scissorsCutLine;
     bool m_drawingScissors;
     bool m_hasScissorsPieces;
-    QPixmap m_scissorsPiece1;
-    QPixmap m_scissorsPiece2;
-    QRegion m_scissorsRegion1;
-    QRegion m_scissorsRegion2;
+    QImage m_scissorsPiece1;
+    QImage m_scissorsPiece2;
+    Unimalen::SpanMask m_scissorsMask1; // Where the pieces were cut from
+    Unimalen::SpanMask m_scissorsMask2;
     QPoint m_piece1Offset;
     QPoint m_piece2Offset;
     bool m_draggingPiece1;
@@ -280,8 +308,17 @@ private:
     QPoint m_pieceDragStart;
 
     // Lasso selection
-    QPolygon m_lassoPolygon;
+    QPolygon m_lassoPolygon; // Outline only, the selected area is m_selection
+    Unimalen::Selection m_selection;
     bool m_hasSelection;
+
+    // Magic wand
+    bool m_magicWandMode;
+    bool m_wandContiguous;
+    int m_wandTolerance;
+    QPoint m_wandSeed; // Of the current wand selection, (-1, -1) if none
+    QImage m_selectionOverlay; // Tint over wand selections, which have no outline
+    void magicWandSelect(const QPoint &seed);
     bool m_drawingLasso;
 
     // Rectangle selection
@@ -289,12 +326,12 @@ private:
     QPoint m_rectSelectStart;
     QPoint m_rectSelectCurrent;
     bool m_drawingRectSelect;
-    QPixmap m_clipboard;
+    QImage m_clipboard;
 
     // Selection dragging
     bool m_draggingSelection;
     QPoint m_dragStartPoint;
-    QPixmap m_selectedPixmap;
+    QImage m_selectedImage;
     QPoint m_selectionOffset;
     bool isPointInSelection(const QPoint &point) const;
 
@@ -309,10 +346,23 @@ private:
 
     // Undo/Redo system
     QUndoStack *m_undoStack;
-    QPixmap m_canvasBeforeEdit;
+    QVector<QImage> m_tilesBeforeEdit; // Current layer tiles when the edit started
+    quint64 m_editLayerId;
+    Unimalen::UndoJournal m_undoJournal;
+    qint64 m_undoBudget;
     void saveCanvasState();
+    void pushLayerUndo(const QString &text);
+
+    Unimalen::RecoveryJournal m_recoveryJournal;
+    void checkpointRecovery();
+    void recordRecovery(const QUndoCommand *command);
+
+    // Neighbouring page composites are rendered once the canvas is idle
+    QTimer *m_prefetchTimer;
+    void prefetchAdjacentPages();
 
     // Document state
     bool m_isModified;
     QString m_filePath;
+    QString m_autoSaveId;
 };
\ No newline at end of file
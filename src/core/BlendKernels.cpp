@@ -0,0 +1,140 @@
+#include "BlendKernels.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UNIMALEN_SSE2
+#include "BlendKernelsSimd.h"
+#endif
+
+#if defined(UNIMALEN_SSE2) && defined(UNIMALEN_HAVE_AVX2_KERNELS)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#define UNIMALEN_AVX2
+#endif
+
+namespace Unimalen {
+
+#ifdef UNIMALEN_AVX2
+// Built with AVX2 enabled in BlendKernelsAvx2.cpp
+int blendRowAvx2(Layer::BlendMode mode, const QRgb *src, QRgb *dst, int count, int opacity);
+
+static bool cpuHasAvx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    // The OS has to save the YMM registers too
+    const bool osSavesYmm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+#ifdef UNIMALEN_SSE2
+namespace {
+
+struct Sse2
+{
+    using Reg = __m128i;
+    static constexpr int PIXELS = 4;
+
+    static Reg load(const QRgb *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    static void store(QRgb *p, Reg v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+    static bool isZero(Reg v) { return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xffff; }
+    static Reg unpackLo(Reg v) { return _mm_unpacklo_epi8(v, _mm_setzero_si128()); }
+    static Reg unpackHi(Reg v) { return _mm_unpackhi_epi8(v, _mm_setzero_si128()); }
+    static Reg pack(Reg lo, Reg hi) { return _mm_packus_epi16(lo, hi); }
+    static Reg alpha(Reg v)
+    {
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+        return _mm_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    static Reg set(int value) { return _mm_set1_epi16(short(value)); }
+    static Reg add(Reg a, Reg b) { return _mm_add_epi16(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm_sub_epi16(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm_mullo_epi16(a, b); }
+    static Reg shiftRight8(Reg v) { return _mm_srli_epi16(v, 8); }
+    static Reg max(Reg a, Reg b) { return _mm_max_epi16(a, b); }
+    static Reg lessThan(Reg a, Reg b) { return _mm_cmplt_epi16(a, b); }
+    static Reg select(Reg mask, Reg a, Reg b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+};
+
+} // namespace
+#endif
+
+static inline int div255(int value)
+{
+    return (value + 128 + ((value + 128) >> 8)) >> 8;
+}
+
+// Per channel, the same formulas QPainter uses for these composition modes
+static inline int blendChannel(Layer::BlendMode mode, int s, int d, int sa, int da)
+{
+    switch (mode) {
+    case Layer::Multiply:
+        return div255(s * d + s * (255 - da) + d * (255 - sa));
+    case Layer::Screen:
+        return s + d - div255(s * d);
+    case Layer::Overlay: {
+        const int uncovered = s * (255 - da) + d * (255 - sa);
+        if (2 * d < da) {
+            return div255(2 * s * d + uncovered);
+        }
+        return div255(sa * da - 2 * (da - d) * (sa - s) + uncovered);
+    }
+    case Layer::Normal:
+    default:
+        return s + div255(d * (255 - sa));
+    }
+}
+
+static void blendRowScalar(Layer::BlendMode mode, const QRgb *src, QRgb *dst, int count, int opacity)
+{
+    for (int x = 0; x < count; ++x) {
+        QRgb s = src[x];
+        if (s == 0) {
+            continue;
+        }
+        if (opacity < 255) {
+            s = qRgba(div255(qRed(s) * opacity), div255(qGreen(s) * opacity),
+                      div255(qBlue(s) * opacity), div255(qAlpha(s) * opacity));
+        }
+        const QRgb d = dst[x];
+        const int sa = qAlpha(s);
+        const int da = qAlpha(d);
+        dst[x] = qRgba(qBound(0, blendChannel(mode, qRed(s), qRed(d), sa, da), 255),
+                       qBound(0, blendChannel(mode, qGreen(s), qGreen(d), sa, da), 255),
+                       qBound(0, blendChannel(mode, qBlue(s), qBlue(d), sa, da), 255),
+                       qBound(0, blendChannel(mode, sa, da, sa, da), 255));
+    }
+}
+
+void blendRow(Layer::BlendMode mode, const QRgb *src, QRgb *dst, int count, int opacity)
+{
+    opacity = qBound(0, opacity, 255);
+    if (count <= 0 || opacity == 0) {
+        return;
+    }
+
+    int done = 0;
+#ifdef UNIMALEN_AVX2
+    static const bool hasAvx2 = cpuHasAvx2();
+    if (hasAvx2) {
+        done = blendRowAvx2(mode, src, dst, count, opacity);
+    }
+#endif
+#ifdef UNIMALEN_SSE2
+    done += blendRowVector<Sse2>(mode, src + done, dst + done, count - done, opacity);
+#endif
+    blendRowScalar(mode, src + done, dst + done, count - done, opacity);
+}
+
+} // namespace Unimalen
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "Layer.h"
+#include <QRgb>
+
+namespace Unimalen {
+
+// Blend count premultiplied ARGB32 pixels of src onto dst in place with a
+// layer blend mode at opacity 0-255. The results follow the QPainter
+// composition modes the blend modes used to map to. Runs AVX2 or SSE2
+// kernels when the CPU has them and plain C++ otherwise.
+void blendRow(Layer::BlendMode mode, const QRgb *src, QRgb *dst, int count, int opacity = 255);
+
+} // namespace Unimalen
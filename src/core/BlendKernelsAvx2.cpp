@@ -0,0 +1,44 @@
+// Compiled with AVX2 enabled, see CMakeLists.txt. Only called after
+// blendRow() has checked that the CPU supports it.
+
+#include <immintrin.h>
+#include "BlendKernelsSimd.h"
+
+namespace Unimalen {
+namespace {
+
+struct Avx2
+{
+    using Reg = __m256i;
+    static constexpr int PIXELS = 8;
+
+    static Reg load(const QRgb *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    static void store(QRgb *p, Reg v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+    static bool isZero(Reg v) { return _mm256_testz_si256(v, v); }
+    // Unpack and pack both work within 128-bit lanes, so they undo each other
+    static Reg unpackLo(Reg v) { return _mm256_unpacklo_epi8(v, _mm256_setzero_si256()); }
+    static Reg unpackHi(Reg v) { return _mm256_unpackhi_epi8(v, _mm256_setzero_si256()); }
+    static Reg pack(Reg lo, Reg hi) { return _mm256_packus_epi16(lo, hi); }
+    static Reg alpha(Reg v)
+    {
+        v = _mm256_shufflelo_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+        return _mm256_shufflehi_epi16(v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    static Reg set(int value) { return _mm256_set1_epi16(short(value)); }
+    static Reg add(Reg a, Reg b) { return _mm256_add_epi16(a, b); }
+    static Reg sub(Reg a, Reg b) { return _mm256_sub_epi16(a, b); }
+    static Reg mul(Reg a, Reg b) { return _mm256_mullo_epi16(a, b); }
+    static Reg shiftRight8(Reg v) { return _mm256_srli_epi16(v, 8); }
+    static Reg max(Reg a, Reg b) { return _mm256_max_epi16(a, b); }
+    static Reg lessThan(Reg a, Reg b) { return _mm256_cmpgt_epi16(b, a); }
+    static Reg select(Reg mask, Reg a, Reg b) { return _mm256_blendv_epi8(b, a, mask); }
+};
+
+} // namespace
+
+int blendRowAvx2(Layer::BlendMode mode, const QRgb *src, QRgb *dst, int count, int opacity)
+{
+    return blendRowVector<Avx2>(mode, src, dst, count, opacity);
+}
+
+} // namespace Unimalen
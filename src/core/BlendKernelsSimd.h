@@ -0,0 +1,108 @@
+#pragma once
+
+// Blend kernels written once against a small vector interface V and
+// compiled per instruction set. Only included by BlendKernels.cpp and
+// BlendKernelsAvx2.cpp; everything here has internal linkage so the two
+// builds never mix.
+//
+// V works on 16-bit lanes holding one channel each and provides:
+//   Reg, PIXELS, load, store, isZero, unpackLo, unpackHi, pack,
+//   alpha (each pixel's alpha in all four of its lanes), set, add, sub,
+//   mul (low 16 bits), shiftRight8, max, lessThan (signed), select
+
+#include "Layer.h"
+#include <QRgb>
+
+namespace Unimalen {
+namespace {
+
+// a * b / 255 rounded, exact for a, b in 0-255
+template <typename V>
+inline typename V::Reg mul255(typename V::Reg a, typename V::Reg b)
+{
+    typename V::Reg t = V::add(V::mul(a, b), V::set(128));
+    return V::shiftRight8(V::add(t, V::shiftRight8(t)));
+}
+
+// One register of 16-bit channels, s over d
+template <typename V, Layer::BlendMode mode>
+inline typename V::Reg blendChannels(typename V::Reg s, typename V::Reg d)
+{
+    using Reg = typename V::Reg;
+    const Reg full = V::set(255);
+    const Reg sa = V::alpha(s);
+
+    if (mode == Layer::Normal) {
+        return V::add(s, mul255<V>(d, V::sub(full, sa)));
+    }
+    if (mode == Layer::Screen) {
+        return V::sub(V::add(s, d), mul255<V>(s, d));
+    }
+
+    // Multiply and Overlay share the parts of s and d left uncovered
+    const Reg da = V::alpha(d);
+    const Reg uncovered = V::add(mul255<V>(s, V::sub(full, da)), mul255<V>(d, V::sub(full, sa)));
+    if (mode == Layer::Multiply) {
+        return V::add(mul255<V>(s, d), uncovered);
+    }
+
+    // Overlay: multiply where the backdrop is dark, screen where it is light
+    const Reg dark = V::add(mul255<V>(s, d), mul255<V>(s, d));
+    const Reg inverse = mul255<V>(V::sub(da, d), V::sub(sa, s));
+    const Reg light = V::max(V::sub(mul255<V>(sa, da), V::add(inverse, inverse)), V::set(0));
+    return V::add(V::select(V::lessThan(V::add(d, d), da), dark, light), uncovered);
+}
+
+// Blends whole registers of pixels and returns how many it did; the
+// caller finishes the remainder
+template <typename V, Layer::BlendMode mode, bool constantAlpha>
+int blendRowSimd(const QRgb *src, QRgb *dst, int count, int opacity)
+{
+    using Reg = typename V::Reg;
+    const Reg scale = V::set(opacity);
+
+    int x = 0;
+    for (; x + V::PIXELS <= count; x += V::PIXELS) {
+        const Reg s = V::load(src + x);
+        // A transparent source leaves dst alone in every mode
+        if (V::isZero(s)) {
+            continue;
+        }
+        const Reg d = V::load(dst + x);
+
+        Reg sLo = V::unpackLo(s);
+        Reg sHi = V::unpackHi(s);
+        if (constantAlpha) {
+            sLo = mul255<V>(sLo, scale);
+            sHi = mul255<V>(sHi, scale);
+        }
+        const Reg lo = blendChannels<V, mode>(sLo, V::unpackLo(d));
+        const Reg hi = blendChannels<V, mode>(sHi, V::unpackHi(d));
+        V::store(dst + x, V::pack(lo, hi));
+    }
+    return x;
+}
+
+template <typename V>
+int blendRowVector(Layer::BlendMode mode, const QRgb *src, QRgb *dst, int count, int opacity)
+{
+    const bool opaque = opacity >= 255;
+    switch (mode) {
+    case Layer::Multiply:
+        return opaque ? blendRowSimd<V, Layer::Multiply, false>(src, dst, count, opacity)
+                      : blendRowSimd<V, Layer::Multiply, true>(src, dst, count, opacity);
+    case Layer::Screen:
+        return opaque ? blendRowSimd<V, Layer::Screen, false>(src, dst, count, opacity)
+                      : blendRowSimd<V, Layer::Screen, true>(src, dst, count, opacity);
+    case Layer::Overlay:
+        return opaque ? blendRowSimd<V, Layer::Overlay, false>(src, dst, count, opacity)
+                      : blendRowSimd<V, Layer::Overlay, true>(src, dst, count, opacity);
+    case Layer::Normal:
+    default:
+        return opaque ? blendRowSimd<V, Layer::Normal, false>(src, dst, count, opacity)
+                      : blendRowSimd<V, Layer::Normal, true>(src, dst, count, opacity);
+    }
+}
+
+} // namespace
+} // namespace Unimalen
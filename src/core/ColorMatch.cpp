@@ -0,0 +1,80 @@
+#include "ColorMatch.h"
+#include "Parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UNIMALEN_SSE2
+#endif
+
+namespace Unimalen {
+
+void matchColor(const QRgb *pixels, int count, QRgb target, int tolerance, quint8 *out)
+{
+    tolerance = qBound(0, tolerance, 255);
+    int x = 0;
+
+#ifdef UNIMALEN_SSE2
+    // |p - t| per byte from two saturating subtractions; a pixel matches
+    // when no byte of it exceeds the tolerance
+    const __m128i targets = _mm_set1_epi32(int(target));
+    const __m128i limits = _mm_set1_epi8(char(tolerance));
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 4 <= count; x += 4) {
+        const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + x));
+        const __m128i difference = _mm_or_si128(_mm_subs_epu8(p, targets), _mm_subs_epu8(targets, p));
+        const __m128i excess = _mm_subs_epu8(difference, limits);
+        const int bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(excess, zero)));
+        out[x] = bits & 1;
+        out[x + 1] = (bits >> 1) & 1;
+        out[x + 2] = (bits >> 2) & 1;
+        out[x + 3] = (bits >> 3) & 1;
+    }
+#endif
+
+    for (; x < count; ++x) {
+        const QRgb p = pixels[x];
+        out[x] = qAbs(qRed(p) - qRed(target)) <= tolerance
+              && qAbs(qGreen(p) - qGreen(target)) <= tolerance
+              && qAbs(qBlue(p) - qBlue(target)) <= tolerance
+              && qAbs(qAlpha(p) - qAlpha(target)) <= tolerance;
+    }
+}
+
+SpanMask selectColor(const QImage &source, QRgb target, int tolerance)
+{
+    QImage image = source;
+    if (image.format() != QImage::Format_ARGB32_Premultiplied
+        && image.format() != QImage::Format_ARGB32
+        && image.format() != QImage::Format_RGB32) {
+        image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    }
+
+    const int width = image.width();
+    const int height = image.height();
+    QVector<quint8> matches(qsizetype(width) * height);
+    quint8 *matchPixels = matches.data();
+    parallelFor(height, [&](int y) {
+        matchColor(reinterpret_cast<const QRgb*>(image.constScanLine(y)), width, target, tolerance,
+                   matchPixels + qsizetype(y) * width);
+    });
+
+    SpanMask mask(width, height);
+    for (int y = 0; y < height; ++y) {
+        const quint8 *line = matches.constData() + qsizetype(y) * width;
+        int x = 0;
+        while (x < width) {
+            if (!line[x]) {
+                ++x;
+                continue;
+            }
+            const int start = x;
+            while (x < width && line[x]) {
+                ++x;
+            }
+            mask.addSpan(y, start, x - start);
+        }
+    }
+    return mask;
+}
+
+} // namespace Unimalen
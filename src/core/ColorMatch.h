@@ -0,0 +1,17 @@
+#pragma once
+
+#include "SpanMask.h"
+#include <QImage>
+#include <QRgb>
+
+namespace Unimalen {
+
+// Set out[i] to 1 where pixels[i] is within tolerance of target in every
+// channel (alpha included) and to 0 elsewhere. Compares four pixels per
+// step with SSE2 where the target has it.
+void matchColor(const QRgb *pixels, int count, QRgb target, int tolerance, quint8 *out);
+
+// Every pixel of image within tolerance of target, connected or not
+SpanMask selectColor(const QImage &image, QRgb target, int tolerance);
+
+} // namespace Unimalen
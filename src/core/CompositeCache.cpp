@@ -0,0 +1,36 @@
+#include "CompositeCache.h"
+
+namespace Unimalen {
+
+CompositeCache::CompositeCache(qint64 budget)
+    : m_images(budget)
+{
+}
+
+QImage CompositeCache::find(quint64 generation)
+{
+    QMutexLocker locker(&m_mutex);
+    const QImage *image = m_images.object(generation);
+    return image ? *image : QImage();
+}
+
+void CompositeCache::insert(quint64 generation, const QImage &image)
+{
+    QMutexLocker locker(&m_mutex);
+    // Images larger than the whole budget are not kept
+    m_images.insert(generation, new QImage(image), image.sizeInBytes());
+}
+
+qint64 CompositeCache::budget() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_images.maxCost();
+}
+
+void CompositeCache::setBudget(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_images.setMaxCost(bytes);
+}
+
+} // namespace Unimalen
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+
+namespace Unimalen {
+
+// Flattened pages keyed by Page::generation(), least recently used first
+// out once the images exceed the byte budget. Generations are unique
+// across pages, so one cache serves every page of a document and its
+// copies. Safe to use from encoder threads.
+class CompositeCache
+{
+public:
+    explicit CompositeCache(qint64 budget);
+
+    // Returns a null image on a miss
+    QImage find(quint64 generation);
+    void insert(quint64 generation, const QImage &image);
+
+    qint64 budget() const;
+    void setBudget(qint64 bytes);
+
+private:
+    mutable QMutex m_mutex;
+    QCache<quint64, QImage> m_images; // Cost is in bytes
+};
+
+} // namespace Unimalen
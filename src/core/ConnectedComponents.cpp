@@ -0,0 +1,115 @@
+#include "ConnectedComponents.h"
+#include <algorithm>
+
+namespace Unimalen {
+
+static int findRoot(QVector<int> &parent, int label)
+{
+    int root = label;
+    while (parent[root] != root) {
+        root = parent[root];
+    }
+    while (parent[label] != root) {
+        int next = parent[label];
+        parent[label] = root;
+        label = next;
+    }
+    return root;
+}
+
+ConnectedComponents::ConnectedComponents(const QVector<quint8> &open, int width, int height)
+    : m_width(width)
+    , m_height(height)
+    , m_rowStart(height + 1, 0)
+{
+    if (open.size() != qsizetype(width) * height) {
+        return;
+    }
+
+    // Provisional labels, one per run, joined where runs touch vertically
+    QVector<int> parent;
+    for (int y = 0; y < height; ++y) {
+        m_rowStart[y] = m_runs.size();
+        const quint8 *line = open.constData() + qsizetype(y) * width;
+        const int previousStart = y > 0 ? m_rowStart[y - 1] : 0;
+        const int previousEnd = m_rowStart[y];
+        int above = previousStart;
+
+        int x = 0;
+        while (x < width) {
+            if (!line[x]) {
+                ++x;
+                continue;
+            }
+            const int start = x;
+            while (x < width && line[x]) {
+                ++x;
+            }
+
+            const int label = parent.size();
+            parent.append(label);
+            m_runs.append(Run{start, x - start, label});
+
+            // Runs above are sorted, skip those ending before this one
+            while (above < previousEnd && m_runs[above].x + m_runs[above].length <= start) {
+                ++above;
+            }
+            for (int i = above; i < previousEnd && m_runs[i].x < x; ++i) {
+                int a = findRoot(parent, label);
+                int b = findRoot(parent, m_runs[i].label);
+                if (a != b) {
+                    parent[qMax(a, b)] = qMin(a, b);
+                }
+            }
+        }
+    }
+    m_rowStart[height] = m_runs.size();
+
+    // Final labels are numbered by root and collect bounds and areas
+    QVector<int> finalLabel(parent.size(), 0);
+    for (int y = 0; y < height; ++y) {
+        for (int i = m_rowStart[y]; i < m_rowStart[y + 1]; ++i) {
+            Run &run = m_runs[i];
+            int root = findRoot(parent, run.label);
+            if (finalLabel[root] == 0) {
+                m_bounds.append(QRect());
+                m_areas.append(0);
+                finalLabel[root] = m_bounds.size();
+            }
+            run.label = finalLabel[root];
+            m_bounds[run.label - 1] |= QRect(run.x, y, run.length, 1);
+            m_areas[run.label - 1] += run.length;
+        }
+    }
+}
+
+int ConnectedComponents::labelAt(int x, int y) const
+{
+    if (x < 0 || x >= m_width || y < 0 || y >= m_height) {
+        return 0;
+    }
+
+    auto begin = m_runs.constBegin() + m_rowStart[y];
+    auto end = m_runs.constBegin() + m_rowStart[y + 1];
+    auto after = std::upper_bound(begin, end, x, [](int value, const Run &run) { return value < run.x; });
+    if (after == begin || x >= (after - 1)->x + (after - 1)->length) {
+        return 0;
+    }
+    return (after - 1)->label;
+}
+
+SpanMask ConnectedComponents::mask(int label) const
+{
+    SpanMask result(m_width, m_height);
+    const QRect bounds = boundingRect(label);
+    for (int y = bounds.top(); y <= bounds.bottom(); ++y) {
+        for (int i = m_rowStart[y]; i < m_rowStart[y + 1]; ++i) {
+            if (m_runs[i].label == label) {
+                result.addSpan(y, m_runs[i].x, m_runs[i].length);
+            }
+        }
+    }
+    return result;
+}
+
+} // namespace Unimalen
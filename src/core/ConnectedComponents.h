@@ -0,0 +1,40 @@
+#pragma once
+
+#include "SpanMask.h"
+#include <QRect>
+#include <QVector>
+
+namespace Unimalen {
+
+// The 4-connected regions of the open (non-zero) pixels of a width x height
+// map. Labelling is a single pass over the runs of each row, joining runs
+// that overlap one on the row above in a union-find, so it is linear in the
+// number of pixels and only runs are stored. Labels are 1 .. count(), in
+// the order their first pixel appears; 0 means no component.
+class ConnectedComponents
+{
+public:
+    ConnectedComponents(const QVector<quint8> &open, int width, int height);
+
+    int count() const { return m_bounds.size(); }
+    int labelAt(int x, int y) const;
+    QRect boundingRect(int label) const { return m_bounds.value(label - 1); }
+    qint64 area(int label) const { return m_areas.value(label - 1); }
+    SpanMask mask(int label) const;
+
+private:
+    struct Run {
+        int x;
+        int length;
+        int label;
+    };
+
+    int m_width;
+    int m_height;
+    QVector<Run> m_runs;
+    QVector<int> m_rowStart; // Index of the first run of each row, plus an end marker
+    QVector<QRect> m_bounds;
+    QVector<qint64> m_areas;
+};
+
+} // namespace Unimalen
@@ -0,0 +1,75 @@
+#include "DistanceTransform.h"
+#include "Parallel.h"
+
+namespace Unimalen {
+
+static const float FAR_AWAY = 1e20f;
+
+// Squared distance transform of the sampled function f of length n into d,
+// using the lower envelope of the parabolas rooted at each sample
+static void distance1D(const float *f, int n, float *d, int *v, float *z)
+{
+    int k = 0;
+    v[0] = 0;
+    z[0] = -FAR_AWAY;
+    z[1] = FAR_AWAY;
+    for (int q = 1; q < n; ++q) {
+        float s = ((f[q] + float(q) * q) - (f[v[k]] + float(v[k]) * v[k])) / (2.0f * q - 2.0f * v[k]);
+        while (s <= z[k]) {
+            --k;
+            s = ((f[q] + float(q) * q) - (f[v[k]] + float(v[k]) * v[k])) / (2.0f * q - 2.0f * v[k]);
+        }
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = FAR_AWAY;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (z[k + 1] < q) {
+            ++k;
+        }
+        const float offset = float(q - v[k]);
+        d[q] = offset * offset + f[v[k]];
+    }
+}
+
+QVector<float> squaredDistanceTransform(const QVector<quint8> &features, int width, int height)
+{
+    QVector<float> distance(qsizetype(width) * height);
+    if (distance.isEmpty() || features.size() != distance.size()) {
+        return distance;
+    }
+
+    const quint8 *feature = features.constData();
+    float *grid = distance.data();
+
+    // Columns, with a gather into contiguous buffers per column
+    parallelFor(width, [&](int x) {
+        QVector<float> f(height);
+        QVector<float> d(height);
+        QVector<int> v(height);
+        QVector<float> z(height + 1);
+        for (int y = 0; y < height; ++y) {
+            f[y] = feature[qsizetype(y) * width + x] ? 0.0f : FAR_AWAY;
+        }
+        distance1D(f.constData(), height, d.data(), v.data(), z.data());
+        for (int y = 0; y < height; ++y) {
+            grid[qsizetype(y) * width + x] = d[y];
+        }
+    });
+
+    // Rows, on the column results
+    parallelFor(height, [&](int y) {
+        float *row = grid + qsizetype(y) * width;
+        QVector<float> f(row, row + width);
+        QVector<int> v(width);
+        QVector<float> z(width + 1);
+        distance1D(f.constData(), width, row, v.data(), z.data());
+    });
+
+    return distance;
+}
+
+} // namespace Unimalen
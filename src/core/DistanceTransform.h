@@ -0,0 +1,13 @@
+#pragma once
+
+#include <QVector>
+
+namespace Unimalen {
+
+// Exact squared Euclidean distance from every pixel of a width x height grid
+// to the nearest pixel where features is non-zero, in linear time
+// (Felzenszwalb and Huttenlocher: a 1D lower envelope pass over the columns,
+// then over the rows). Pixels are far away when there are no features.
+QVector<float> squaredDistanceTransform(const QVector<quint8> &features, int width, int height);
+
+} // namespace Unimalen
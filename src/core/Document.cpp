@@ -2,9 +2,21 @@
 #include <QPainter>
 #include <QDir>
 #include <QFile>
+#include <QSaveFile>
 #include <QTextStream>
-#include <QProcess>
-#include <QTemporaryDir>
+#include <QXmlStreamReader>
+#include <QHash>
+#include <QBuffer>
+#include "ZipReader.h"
+#include "ZipWriter.h"
+#include "Parallel.h"
+#include "PageSource.h"
+#include "EncodeCache.h"
+#include "CompositeCache.h"
+#include "GrfxFile.h"
+#include <QDebug>
+#include <QThreadPool>
+#include <atomic>
 
 namespace Unimalen {
 
@@ -14,6 +26,8 @@ Document::Document(int width, int height)
     , m_pageSize(PageSize::Custom)
     , m_paperColor(PaperColor::White)
     , m_currentPageIndex(0)
+    , m_encodeCache(new EncodeCache)
+    , m_compositeCache(new CompositeCache(qint64(DEFAULT_COMPOSITE_CACHE_MB) * 1024 * 1024))
 {
     // Create initial page
     m_pages.append(Page(width, height, m_paperColor));
@@ -23,6 +37,10 @@ Document::Document(int width, int height)
 void Document::setCurrentPageIndex(int index)
 {
     if (index >= 0 && index < m_pages.size()) {
+        // Pages that are not on screen keep only their tiles
+        if (index != m_currentPageIndex && m_currentPageIndex >= 0 && m_currentPageIndex < m_pages.size()) {
+            m_pages[m_currentPageIndex].releaseSurfaces();
+        }
         m_currentPageIndex = index;
     }
 }
@@ -35,7 +53,11 @@ Page& Document::currentPage()
     if (m_currentPageIndex < 0 || m_currentPageIndex >= m_pages.size()) {
         m_currentPageIndex = 0;
     }
-    return m_pages[m_currentPageIndex];
+    Page &page = m_pages[m_currentPageIndex];
+    if (!page.isLoaded() && !page.load()) {
+        qWarning() << "Failed to load page" << m_currentPageIndex + 1;
+    }
+    return page;
 }
 
 const Page& Document::currentPage() const
@@ -46,17 +68,18 @@ const Page& Document::currentPage() const
 Page& Document::pageAt(int index)
 {
     if (index >= 0 && index < m_pages.size()) {
-        return m_pages[index];
+        Page &page = m_pages[index];
+        if (!page.isLoaded() && !page.load()) {
+            qWarning() << "Failed to load page" << index + 1;
+        }
+        return page;
     }
     return currentPage();
 }
 
 const Page& Document::pageAt(int index) const
 {
-    if (index >= 0 && index < m_pages.size()) {
-        return m_pages[index];
-    }
-    return currentPage();
+    return const_cast<Document*>(this)->pageAt(index);
 }
 
 void Document::addPage()
@@ -83,17 +106,15 @@ void Document::duplicatePage(int index)
         return;
     }
     if (index >= 0 && index < m_pages.size()) {
-        // Create a new page and copy all layers
-        Page newPage(m_width, m_height, m_paperColor);
-        newPage.clear();
-
-        const Page& source = m_pages[index];
-        for (const Layer& layer : source.layers()) {
-            newPage.addLayer(layer.name() + " copy");
-            newPage.layers().last().pixmap() = layer.pixmap().copy();
-            newPage.layers().last().setVisible(layer.isVisible());
-            newPage.layers().last().setOpacity(layer.opacity());
-            newPage.layers().last().setBlendMode(layer.blendMode());
+        // Copy the page with its generation, which also flushes it, so both
+        // share a cached composite until one of them is edited
+        const Page& source = pageAt(index);
+        source.generation();
+        Page newPage = source;
+
+        for (Layer& layer : newPage.layers()) {
+            // Layer copies carry tiles and properties, not the edit surface
+            layer = layer.duplicate();
         }
 
         m_pages.insert(index + 1, newPage);
@@ -127,6 +148,21 @@ const Layer& Document::currentLayer() const
     return currentPage().currentLayer();
 }
 
+Layer* Document::findLayer(quint64 layerId, int *pageIndex)
+{
+    for (int i = 0; i < m_pages.size(); ++i) {
+        for (Layer &layer : m_pages[i].layers()) {
+            if (layer.id() == layerId) {
+                if (pageIndex) {
+                    *pageIndex = i;
+                }
+                return &layer;
+            }
+        }
+    }
+    return nullptr;
+}
+
 void Document::addLayer(const QString &name)
 {
     currentPage().addLayer(name);
@@ -168,167 +204,344 @@ void Document::setLayerName(int index, const QString &name)
 }
 
 // Compositing
-QPixmap Document::composite() const
+QImage Document::composite() const
+{
+    return cachedComposite(currentPage());
+}
+
+void Document::compositeToImage(QImage &target) const
 {
-    return currentPage().composite();
+    currentPage().compositeToImage(target);
 }
 
-void Document::compositeToPixmap(QPixmap &target) const
+void Document::compositeRect(QImage &target, const QRect &rect) const
 {
-    currentPage().compositeToPixmap(target);
+    currentPage().compositeRect(target, rect);
 }
 
-QPixmap Document::compositePage(int pageIndex) const
+QImage Document::compositePage(int pageIndex) const
 {
     if (pageIndex >= 0 && pageIndex < m_pages.size()) {
-        return m_pages[pageIndex].composite();
+        return cachedComposite(pageAt(pageIndex));
     }
-    return QPixmap();
+    return QImage();
 }
 
-bool Document::saveAsORA(const QString &fileName) const
+void Document::setCompositeCacheBudget(qint64 bytes)
 {
-    QTemporaryDir tempDir;
-    if (!tempDir.isValid()) {
-        return false;
+    m_compositeCache->setBudget(bytes);
+}
+
+void Document::prefetchComposite(int pageIndex)
+{
+    if (pageIndex < 0 || pageIndex >= m_pages.size()) {
+        return;
+    }
+
+    // Pending pages are left to their own prefetch, loading one here would
+    // decode it on the GUI thread
+    const Page &page = m_pages.at(pageIndex);
+    if (!page.isLoaded()) {
+        return;
     }
 
-    QString tempPath = tempDir.path();
+    // Looking it up also keeps a cached page from being evicted
+    const quint64 generation = page.generation();
+    if (!m_compositeCache->find(generation).isNull()) {
+        return;
+    }
 
-    // Create directory structure
-    QDir().mkpath(tempPath + "/data");
-    QDir().mkpath(tempPath + "/Thumbnails");
+    // The copy gets Layer objects of its own, which flushes the page, so
+    // the pool only shares tiles with it. The page can be edited meanwhile;
+    // the result is then just unused.
+    Page snapshot = page;
+    snapshot.detachLayers();
+    QSharedPointer<CompositeCache> cache = m_compositeCache;
+    QThreadPool::globalInstance()->start([snapshot, cache, generation]() {
+        cache->insert(generation, snapshot.composite());
+    });
+}
 
-    // Save layers as PNG files (from current page)
-    const Page& page = currentPage();
-    for (int i = 0; i < page.layers().size(); ++i) {
-        QString layerPath = tempPath + QString("/data/layer%1.png").arg(i);
-        if (!page.layers()[i].pixmap().save(layerPath, "PNG")) {
-            return false;
-        }
+QImage Document::cachedComposite(const Page &page) const
+{
+    const quint64 generation = page.generation();
+    QImage image = m_compositeCache->find(generation);
+    if (image.isNull()) {
+        image = page.composite();
+        m_compositeCache->insert(generation, image);
     }
+    return image;
+}
 
-    // Create mimetype file
-    QFile mimeFile(tempPath + "/mimetype");
-    if (!mimeFile.open(QIODevice::WriteOnly)) {
-        return false;
+Document Document::snapshot() const
+{
+    Document copy = *this;
+    for (int i = 0; i < copy.m_pages.size(); ++i) {
+        copy.m_pages[i].detachLayers();
     }
-    mimeFile.write("image/openraster");
-    mimeFile.close();
+    return copy;
+}
 
-    // Create stack.xml
-    QFile stackFile(tempPath + "/stack.xml");
-    if (!stackFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        return false;
+MemoryStats Document::memoryStats() const
+{
+    MemoryStats stats;
+
+    // Tiles are implicitly shared, copies of the same data have the same cache key
+    QHash<qint64, QPair<qint64, int>> tileRefs;
+    for (const Page &page : m_pages) {
+        for (const Layer &layer : page.layers()) {
+            if (layer.hasSurface()) {
+                stats.surfaceBytes += qint64(layer.width()) * layer.height() * 4;
+            }
+            for (int i = 0; i < layer.tileCount(); ++i) {
+                const QImage &tile = layer.tileAt(i);
+                if (!tile.isNull()) {
+                    QPair<qint64, int> &ref = tileRefs[tile.cacheKey()];
+                    ref.first = tile.sizeInBytes();
+                    ++ref.second;
+                }
+            }
+        }
+    }
+
+    for (const QPair<qint64, int> &ref : tileRefs) {
+        if (ref.second > 1) {
+            stats.sharedBytes += ref.first;
+        } else {
+            stats.uniqueBytes += ref.first;
+        }
     }
+    return stats;
+}
+
+Document::EncodedPage Document::encodeORA(const Page &page) const
+{
+    EncodedPage encoded;
 
-    QTextStream stackStream(&stackFile);
+    // Write layer information (in reverse order - bottom to top)
+    QTextStream stackStream(&encoded.stack);
     stackStream << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
     stackStream << "<image version=\"0.0.3\" w=\"" << m_width << "\" h=\"" << m_height
                 << "\" xres=\"" << DEFAULT_DPI << "\" yres=\"" << DEFAULT_DPI << "\">\n";
     stackStream << "  <stack>\n";
-
-    // Write layer information (in reverse order - bottom to top)
     for (int i = page.layers().size() - 1; i >= 0; --i) {
         const Layer &layer = page.layers()[i];
-        stackStream << "    <layer name=\"" << layer.name()
+        stackStream << "    <layer name=\"" << layer.name().toHtmlEscaped()
                    << "\" src=\"data/layer" << i << ".png\""
                    << " x=\"0\" y=\"0\""
                    << " opacity=\"" << layer.opacity() << "\""
                    << " visibility=\"" << (layer.isVisible() ? "visible" : "hidden") << "\""
-                   << " composite-op=\"svg:src-over\"/>\n";
+                   << " composite-op=\"" << compositeOpForBlendMode(layer.blendMode()) << "\"/>\n";
     }
-
     stackStream << "  </stack>\n";
     stackStream << "</image>\n";
-    stackFile.close();
+    stackStream.flush();
+
+    // PNG deflate dominates, so the layers and the thumbnail are encoded
+    // concurrently; the last index is the thumbnail. Anything unchanged
+    // since the previous save reuses its bytes from the encode cache.
+    const int layerCount = page.layers().size();
+    encoded.layers.resize(layerCount);
+    QByteArray *layerData = encoded.layers.data();
+    parallelFor(layerCount + 1, [&](int i) {
+        if (i < layerCount) {
+            const Layer &layer = page.layers()[i];
+            QByteArray key = "layer:" + QByteArray::number(layer.generation());
+            layerData[i] = m_encodeCache->find(key);
+            if (layerData[i].isNull()) {
+                layerData[i] = encodePNG(layer.toImage());
+                m_encodeCache->insert(key, layerData[i]);
+            }
+        } else {
+            QByteArray key = "thumbnail:" + QByteArray::number(page.generation());
+            encoded.thumbnail = m_encodeCache->find(key);
+            if (encoded.thumbnail.isNull()) {
+                QImage thumbnail = cachedComposite(page).scaled(256, 256, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+                encoded.thumbnail = encodePNG(thumbnail);
+                m_encodeCache->insert(key, encoded.thumbnail);
+            }
+        }
+    });
 
-    // Create thumbnail
-    QPixmap composited = composite();
-    QPixmap thumbnail = composited.scaled(256, 256, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-    if (!thumbnail.save(tempPath + "/Thumbnails/thumbnail.png", "PNG")) {
+    return encoded;
+}
+
+bool Document::writeORA(const EncodedPage &encoded, const QString &fileName)
+{
+    ZipWriter zip(fileName);
+    if (!zip.open()) {
         return false;
     }
 
-    // Create ZIP file using system zip command
-    QProcess zipProcess;
-    zipProcess.setWorkingDirectory(tempPath);
+    // The spec requires mimetype first and uncompressed
+    zip.addFile("mimetype", "image/openraster", ZipWriter::Stored);
+    zip.addFile("stack.xml", encoded.stack, ZipWriter::Deflated);
 
-    QStringList args;
-    args << "-r" << fileName << ".";
+    // PNG data is already deflated, store it as is
+    for (int i = 0; i < encoded.layers.size(); ++i) {
+        if (encoded.layers[i].isEmpty()) {
+            return false;
+        }
+        zip.addFile(QString("data/layer%1.png").arg(i), encoded.layers[i], ZipWriter::Stored);
+    }
+    zip.addFile("Thumbnails/thumbnail.png", encoded.thumbnail, ZipWriter::Stored);
+
+    return zip.close();
+}
 
-    zipProcess.start("zip", args);
-    zipProcess.waitForFinished();
+QByteArray Document::encodePNG(const QImage &image)
+{
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "PNG");
+    return data;
+}
 
-    return zipProcess.exitCode() == 0;
+bool Document::saveAsORA(const QString &fileName) const
+{
+    const Page &page = currentPage();
+    page.flush();
+    bool success = writeORA(encodeORA(page), fileName);
+    m_encodeCache->prune();
+    return success;
 }
 
 bool Document::loadFromORA(const QString &fileName)
 {
-    QTemporaryDir tempDir;
-    if (!tempDir.isValid()) {
+    Page page(m_width, m_height, m_paperColor);
+    if (!readORA(fileName, page)) {
         return false;
     }
 
-    QString tempPath = tempDir.path();
-
-    // Extract ZIP file using system unzip command
-    QProcess unzipProcess;
-    QStringList args;
-    args << fileName << "-d" << tempPath;
-
-    unzipProcess.start("unzip", args);
-    unzipProcess.waitForFinished();
+    currentPage() = page;
+    return true;
+}
 
-    if (unzipProcess.exitCode() != 0) {
+bool Document::readORA(const QString &fileName, Page &page)
+{
+    ZipReader zip(fileName);
+    if (!zip.open() || zip.fileData("mimetype") != "image/openraster") {
         return false;
     }
 
-    // Check if it's a valid ORA file
-    QFile mimeFile(tempPath + "/mimetype");
-    if (!mimeFile.open(QIODevice::ReadOnly)) {
+    struct LayerEntry {
+        QString name;
+        QString src;
+        QPoint offset;
+        qreal opacity;
+        bool visible;
+        Layer::BlendMode blendMode;
+    };
+
+    // stack.xml lists layers top to bottom, nested stacks are flattened
+    QList<LayerEntry> entries;
+    QXmlStreamReader xml(zip.fileData("stack.xml"));
+    while (!xml.atEnd()) {
+        if (xml.readNext() != QXmlStreamReader::StartElement || xml.name() != QLatin1String("layer")) {
+            continue;
+        }
+        QXmlStreamAttributes attributes = xml.attributes();
+        LayerEntry entry;
+        entry.name = attributes.value(QLatin1String("name")).toString();
+        entry.src = attributes.value(QLatin1String("src")).toString();
+        entry.offset = QPoint(attributes.value(QLatin1String("x")).toInt(), attributes.value(QLatin1String("y")).toInt());
+        entry.opacity = attributes.hasAttribute(QLatin1String("opacity")) ? attributes.value(QLatin1String("opacity")).toDouble() : 1.0;
+        entry.visible = attributes.value(QLatin1String("visibility")) != QLatin1String("hidden");
+        entry.blendMode = blendModeFromCompositeOp(attributes.value(QLatin1String("composite-op")).toString());
+        entries.prepend(entry);
+    }
+    if (xml.hasError() || entries.isEmpty()) {
         return false;
     }
-    QByteArray mimeContent = mimeFile.readAll();
-    mimeFile.close();
 
-    if (mimeContent != "image/openraster") {
-        return false;
+    // Pages hold a limited number of layers, keep the bottom ones
+    while (entries.size() > MAX_LAYERS_PER_PAGE) {
+        entries.removeLast();
     }
 
-    // Clear current page layers
-    Page& page = currentPage();
-    page.clear();
-
-    // Load the first layer (simplified - just load layer0.png or layer1.png)
-    QString layerPath = tempPath + "/data/layer0.png";
-    if (!QFile::exists(layerPath)) {
-        layerPath = tempPath + "/data/layer1.png";
-    }
+    // Decode and tile every layer straight from the archive in parallel
+    QList<Layer> layers(entries.size());
+    Layer *decoded = layers.data();
+    std::atomic<bool> failed{false};
+    parallelFor(entries.size(), [&](int i) {
+        const LayerEntry &entry = entries.at(i);
+        QImage image;
+        if (!image.loadFromData(zip.fileData(entry.src), "PNG")) {
+            failed = true;
+            return;
+        }
 
-    QPixmap loadedPixmap;
-    if (!loadedPixmap.load(layerPath)) {
-        // Failed to load
+        Layer layer(entry.name.isEmpty() ? QString("Layer %1").arg(i + 1) : entry.name, page.width(), page.height());
+        if (entry.offset.isNull()) {
+            layer.setImage(image);
+        } else {
+            QPainter painter(&layer.image());
+            painter.drawImage(entry.offset, image);
+        }
+        layer.releaseSurface();
+        layer.setOpacity(entry.opacity);
+        layer.setVisible(entry.visible);
+        layer.setBlendMode(entry.blendMode);
+        decoded[i] = std::move(layer);
+    });
+    if (failed) {
         return false;
     }
 
-    // Draw onto current layer
-    QPainter painter(&currentLayer().pixmap());
-    painter.drawPixmap(0, 0, loadedPixmap);
-
+    page.layers() = layers;
+    page.setCurrentLayerIndex(page.layers().size() - 1);
     return true;
 }
 
+QString Document::compositeOpForBlendMode(Layer::BlendMode mode)
+{
+    switch (mode) {
+        case Layer::Multiply:
+            return "svg:multiply";
+        case Layer::Screen:
+            return "svg:screen";
+        case Layer::Overlay:
+            return "svg:overlay";
+        default:
+            return "svg:src-over";
+    }
+}
+
+Layer::BlendMode Document::blendModeFromCompositeOp(const QString &op)
+{
+    if (op == "svg:multiply") {
+        return Layer::Multiply;
+    } else if (op == "svg:screen") {
+        return Layer::Screen;
+    } else if (op == "svg:overlay") {
+        return Layer::Overlay;
+    }
+    return Layer::Normal;
+}
+
 bool Document::saveAsPNG(const QString &fileName) const
 {
-    QPixmap composited = composite();
-    return composited.save(fileName, "PNG");
+    const Page &page = currentPage();
+    page.flush();
+
+    QByteArray key = "png:" + QByteArray::number(page.generation());
+    QByteArray data = m_encodeCache->find(key);
+    if (data.isNull()) {
+        data = encodePNG(cachedComposite(page));
+        m_encodeCache->insert(key, data);
+    }
+    m_encodeCache->prune();
+
+    QSaveFile file(fileName);
+    return !data.isEmpty() && file.open(QIODevice::WriteOnly)
+        && file.write(data) == data.size() && file.commit();
 }
 
 bool Document::loadFromPNG(const QString &fileName)
 {
-    QPixmap loadedPixmap;
-    if (!loadedPixmap.load(fileName)) {
+    QImage loadedImage;
+    if (!loadedImage.load(fileName)) {
         return false;
     }
 
@@ -337,8 +550,8 @@ bool Document::loadFromPNG(const QString &fileName)
     page.clear();
 
     // Draw loaded image onto layer
-    QPainter painter(&currentLayer().pixmap());
-    painter.drawPixmap(0, 0, loadedPixmap);
+    QPainter painter(&currentLayer().image());
+    painter.drawImage(0, 0, loadedImage);
 
     return true;
 }
@@ -386,91 +599,42 @@ bool Document::saveAsZine(const QString &folderPath) const
         }
     }
 
-    // Save each page as a separate ORA file
-    for (int i = 0; i < m_pages.size(); ++i) {
-        QString pageFileName = dir.filePath(QString("page_%1.ora").arg(i + 1, 2, 10, QChar('0')));
+    // Save each page as a separate ORA file. Pages are encoded concurrently
+    // in batches of one per pool thread, which bounds how many encoded pages
+    // are held in memory, and each batch is written out in page order.
+    const int batchSize = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+    for (int first = 0; first < m_pages.size(); first += batchSize) {
+        const int count = qMin(batchSize, int(m_pages.size()) - first);
 
-        QTemporaryDir tempDir;
-        if (!tempDir.isValid()) {
-            return false;
+        // Loading and flushing touch the pages, keep that on this thread
+        for (int i = first; i < first + count; ++i) {
+            pageAt(i).flush();
         }
 
-        QString tempPath = tempDir.path();
-        QDir().mkpath(tempPath + "/data");
-        QDir().mkpath(tempPath + "/Thumbnails");
-
-        const Page& page = m_pages[i];
+        QVector<EncodedPage> encoded(count);
+        EncodedPage *results = encoded.data();
+        parallelFor(count, [&](int i) {
+            results[i] = encodeORA(m_pages[first + i]);
+        });
 
-        // Save layers as PNG files
-        for (int j = 0; j < page.layers().size(); ++j) {
-            QString layerPath = tempPath + QString("/data/layer%1.png").arg(j);
-            if (!page.layers()[j].pixmap().save(layerPath, "PNG")) {
+        for (int i = 0; i < count; ++i) {
+            QString pageFileName = dir.filePath(QString("page_%1.ora").arg(first + i + 1, 2, 10, QChar('0')));
+            if (!writeORA(encoded[i], pageFileName)) {
                 return false;
             }
         }
-
-        // Create mimetype file
-        QFile mimeFile(tempPath + "/mimetype");
-        if (!mimeFile.open(QIODevice::WriteOnly)) {
-            return false;
-        }
-        mimeFile.write("image/openraster");
-        mimeFile.close();
-
-        // Create stack.xml
-        QFile stackFile(tempPath + "/stack.xml");
-        if (!stackFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
-            return false;
-        }
-
-        QTextStream stackStream(&stackFile);
-        stackStream << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
-        stackStream << "<image version=\"0.0.3\" w=\"" << m_width << "\" h=\"" << m_height
-                    << "\" xres=\"" << DEFAULT_DPI << "\" yres=\"" << DEFAULT_DPI << "\">\n";
-        stackStream << "  <stack>\n";
-
-        for (int j = page.layers().size() - 1; j >= 0; --j) {
-            const Layer &layer = page.layers()[j];
-            stackStream << "    <layer name=\"" << layer.name()
-                       << "\" src=\"data/layer" << j << ".png\""
-                       << " x=\"0\" y=\"0\""
-                       << " opacity=\"" << layer.opacity() << "\""
-                       << " visibility=\"" << (layer.isVisible() ? "visible" : "hidden") << "\""
-                       << " composite-op=\"svg:src-over\"/>\n";
-        }
-
-        stackStream << "  </stack>\n";
-        stackStream << "</image>\n";
-        stackFile.close();
-
-        // Create thumbnail
-        QPixmap composited = page.composite();
-        QPixmap thumbnail = composited.scaled(256, 256, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-        if (!thumbnail.save(tempPath + "/Thumbnails/thumbnail.png", "PNG")) {
-            return false;
-        }
-
-        // Create ZIP file
-        QProcess zipProcess;
-        zipProcess.setWorkingDirectory(tempPath);
-        QStringList args;
-        args << "-r" << pageFileName << ".";
-        zipProcess.start("zip", args);
-        zipProcess.waitForFinished();
-
-        if (zipProcess.exitCode() != 0) {
-            return false;
-        }
     }
+    m_encodeCache->prune();
 
     // Save metadata file
-    QFile metaFile(dir.filePath("zine_meta.txt"));
+    QSaveFile metaFile(dir.filePath("zine_meta.txt"));
     if (metaFile.open(QIODevice::WriteOnly | QIODevice::Text)) {
         QTextStream metaStream(&metaFile);
         metaStream << "pages=" << m_pages.size() << "\n";
         metaStream << "width=" << m_width << "\n";
         metaStream << "height=" << m_height << "\n";
-        metaFile.close();
+        metaStream.flush();
+        metaFile.commit();
     }
 
     return true;
@@ -507,18 +671,112 @@ bool Document::loadFromZine(const QString &folderPath)
         return false;
     }
 
-    // Clear current pages
-    m_pages.clear();
-    m_currentPageIndex = 0;
-
-    // Load each page
+    // Only the first page is decoded now, the rest load on first access
+    // or in the background. The current pages are kept if the first fails.
+    QList<Page> pages;
     for (int i = 0; i < pageCount && i < MAX_PAGES; ++i) {
         QString pageFileName = dir.filePath(QString("page_%1.ora").arg(i + 1, 2, 10, QChar('0')));
 
-        // For now, create empty pages - full ORA loading would go here
-        m_pages.append(Page(m_width, m_height, m_paperColor));
+        Page page(m_width, m_height, m_paperColor);
+        if (QFile::exists(pageFileName)) {
+            QSharedPointer<PageSource> source(new PageSource(m_width, m_height, [pageFileName](Page &target) {
+                return readORA(pageFileName, target);
+            }));
+            if (i > 0) {
+                source->prefetch();
+            }
+            page.setSource(source);
+        }
+        pages.append(page);
+    }
+
+    if (!pages.first().load()) {
+        return false;
+    }
+
+    m_pages = pages;
+    m_currentPageIndex = 0;
+
+    return true;
+}
+
+QSharedPointer<PageSource> Document::grfxSource(const QSharedPointer<GrfxFile> &file, int pageIndex,
+                                                int width, int height)
+{
+    QSharedPointer<PageSource> source(new PageSource(width, height, [file, pageIndex](Page &target) {
+        return file->loadPage(pageIndex, target);
+    }));
+    source->setOrigin(file.data(), pageIndex);
+    return source;
+}
+
+bool Document::saveAsGrfx(const QString &fileName)
+{
+    // Flushing touches the pages, the file only reads them. Pages still
+    // pending from the same file are copied over without being decoded.
+    for (const Page &page : m_pages) {
+        if (page.isLoaded()) {
+            page.flush();
+        }
     }
 
+    QSharedPointer<GrfxFile> file = m_grfxFile;
+    if (!file || file->fileName() != fileName) {
+        file.reset(new GrfxFile(fileName));
+    }
+    if (!file->save(*this)) {
+        return false;
+    }
+
+    // The new index is in document order, so pages still pending load from
+    // their new position
+    for (int i = 0; i < m_pages.size(); ++i) {
+        const PageSource *source = m_pages[i].source();
+        if (source && source->owner() == file.data()) {
+            m_pages[i].setSource(grfxSource(file, i, m_width, m_height));
+        }
+    }
+    m_grfxFile = file;
+    return true;
+}
+
+bool Document::loadFromGrfx(const QString &fileName)
+{
+    QSharedPointer<GrfxFile> file(new GrfxFile(fileName));
+    if (!file->open()) {
+        return false;
+    }
+
+    const int width = file->width();
+    const int height = file->height();
+    const PaperColor paperColor = PaperColor(file->paperColor());
+
+    // Pages are decoded from the mapped file when first accessed or in the
+    // background, only the current one is decoded now. The current pages
+    // are kept if that fails.
+    const int current = qBound(0, file->currentPage(), file->pageCount() - 1);
+    QList<Page> pages;
+    for (int i = 0; i < file->pageCount(); ++i) {
+        Page page(width, height, paperColor);
+        QSharedPointer<PageSource> source = grfxSource(file, i, width, height);
+        if (i != current) {
+            source->prefetch();
+        }
+        page.setSource(source);
+        pages.append(page);
+    }
+
+    if (!pages[current].load()) {
+        return false;
+    }
+
+    m_width = width;
+    m_height = height;
+    m_pageSize = PageSize::Custom;
+    m_paperColor = paperColor;
+    m_pages = pages;
+    m_currentPageIndex = current;
+    m_grfxFile = file;
     return true;
 }
 
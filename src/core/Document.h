@@ -3,14 +3,30 @@
 #include "Layer.h"
 #include "Page.h"
 #include "Types.h"
-#include <QPixmap>
+#include <QImage>
 #include <QList>
+#include <QSharedPointer>
 #include <QString>
 
 namespace Unimalen {
 
+class CompositeCache;
+class EncodeCache;
+class GrfxFile;
+
 constexpr int MAX_PAGES = 24;
 
+// Pixel memory held by a document. Tile data referenced by more than one
+// layer (after duplicating a layer or page) is counted once, as shared.
+struct MemoryStats
+{
+    qint64 sharedBytes = 0;
+    qint64 uniqueBytes = 0;
+    qint64 surfaceBytes = 0; // Page-sized editing surfaces of active layers
+
+    qint64 totalBytes() const { return sharedBytes + uniqueBytes + surfaceBytes; }
+};
+
 class Document
 {
 public:
@@ -35,6 +51,7 @@ public:
     const Page& currentPage() const;
     Page& pageAt(int index);
     const Page& pageAt(int index) const;
+    const QList<Page>& pages() const { return m_pages; } // Pending pages stay unloaded
 
     void addPage();
     void deletePage(int index);
@@ -50,6 +67,7 @@ public:
 
     Layer& currentLayer();
     const Layer& currentLayer() const;
+    Layer* findLayer(quint64 layerId, int *pageIndex = nullptr); // Searches all pages
 
     void addLayer(const QString &name = QString());
     void deleteLayer(int index);
@@ -61,9 +79,16 @@ public:
     void setLayerName(int index, const QString &name);
 
     // Compositing
-    QPixmap composite() const; // Composite current page
-    void compositeToPixmap(QPixmap &target) const;
-    QPixmap compositePage(int pageIndex) const;
+    QImage composite() const; // Composite current page
+    void compositeToImage(QImage &target) const;
+    void compositeRect(QImage &target, const QRect &rect) const; // Current page, damaged area only
+    QImage compositePage(int pageIndex) const;
+    // Flattened pages are kept for repeat calls up to this many bytes
+    void setCompositeCacheBudget(qint64 bytes);
+    // Render a page's composite on the thread pool, so a later composite()
+    // or compositePage() of it is served from the cache. Pages not loaded
+    // yet are skipped.
+    void prefetchComposite(int pageIndex);
 
     // File I/O
     bool saveAsORA(const QString &fileName) const;
@@ -76,17 +101,50 @@ public:
     bool saveAsZine(const QString &folderPath) const;
     bool loadFromZine(const QString &folderPath);
 
+    // Native multi-page file, see GrfxFile. Saving back to the file the
+    // document was loaded from or last saved to only writes what changed.
+    bool saveAsGrfx(const QString &fileName);
+    bool loadFromGrfx(const QString &fileName);
+
+    // Memory accounting
+    MemoryStats memoryStats() const;
+
+    // Copy to hand to another thread. Pending edits are flushed and the
+    // layers copied here, so the copy shares tile data but no Layer objects.
+    Document snapshot() const;
+
     // Document state
     void clear();
     void resize(int width, int height);
 
 private:
+    // ORA entries of one page, encoded ahead of writing the archive
+    struct EncodedPage {
+        QByteArray stack;
+        QVector<QByteArray> layers;
+        QByteArray thumbnail;
+    };
+
+    EncodedPage encodeORA(const Page &page) const;
+    static bool writeORA(const EncodedPage &encoded, const QString &fileName);
+    static bool readORA(const QString &fileName, Page &page);
+    static QString compositeOpForBlendMode(Layer::BlendMode mode);
+    static Layer::BlendMode blendModeFromCompositeOp(const QString &op);
+    static QByteArray encodePNG(const QImage &image);
+    QImage cachedComposite(const Page &page) const;
+    static QSharedPointer<PageSource> grfxSource(const QSharedPointer<GrfxFile> &file, int pageIndex,
+                                                 int width, int height);
+
     int m_width;
     int m_height;
     PageSize m_pageSize;
     PaperColor m_paperColor;
     QList<Page> m_pages;
     int m_currentPageIndex;
+    // Shared with copies of the document, such as autosave snapshots
+    QSharedPointer<EncodeCache> m_encodeCache;
+    QSharedPointer<CompositeCache> m_compositeCache;
+    QSharedPointer<GrfxFile> m_grfxFile; // File pending pages load from
 };
 
 } // namespace Unimalen
@@ -0,0 +1,35 @@
+#include "EncodeCache.h"
+
+namespace Unimalen {
+
+QByteArray EncodeCache::find(const QByteArray &key)
+{
+    QMutexLocker locker(&m_mutex);
+    auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+        return QByteArray();
+    }
+    it->used = true;
+    return it->data;
+}
+
+void EncodeCache::insert(const QByteArray &key, const QByteArray &data)
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.insert(key, Entry{data, true});
+}
+
+void EncodeCache::prune()
+{
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        if (it->used) {
+            it->used = false;
+            ++it;
+        } else {
+            it = m_entries.erase(it);
+        }
+    }
+}
+
+} // namespace Unimalen
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+
+namespace Unimalen {
+
+// Encoded file data (layer PNGs, thumbnails) from the previous save, keyed
+// by the content it was produced from. Safe to use from encoder threads.
+class EncodeCache
+{
+public:
+    EncodeCache() = default;
+
+    // Returns a null array on a miss
+    QByteArray find(const QByteArray &key);
+    void insert(const QByteArray &key, const QByteArray &data);
+
+    // Drop everything that was not looked up or inserted since the last
+    // prune, so the cache only holds what the latest save produced
+    void prune();
+
+private:
+    struct Entry {
+        QByteArray data;
+        bool used;
+    };
+
+    QMutex m_mutex;
+    QHash<QByteArray, Entry> m_entries;
+};
+
+} // namespace Unimalen
@@ -0,0 +1,196 @@
+#include "FloodFill.h"
+#include "ColorMatch.h"
+#include "DistanceTransform.h"
+#include "Parallel.h"
+#include <QPainter>
+#include <cstring>
+
+namespace Unimalen {
+
+static inline uint mulAlpha(uint value, uint alpha)
+{
+    uint t = value * alpha + 0x80;
+    return (t + (t >> 8)) >> 8;
+}
+
+// Premultiplied source-over
+static inline QRgb sourceOver(QRgb src, QRgb dst)
+{
+    const uint alpha = qAlpha(src);
+    if (alpha == 255) {
+        return src;
+    }
+    if (alpha == 0) {
+        return dst;
+    }
+    const uint inverse = 255 - alpha;
+    return qRgba(qRed(src) + mulAlpha(qRed(dst), inverse),
+                 qGreen(src) + mulAlpha(qGreen(dst), inverse),
+                 qBlue(src) + mulAlpha(qBlue(dst), inverse),
+                 alpha + mulAlpha(qAlpha(dst), inverse));
+}
+
+// Scanline fill over a map of open pixels. Each seed grows into the full
+// run around it, then the rows above and below get one seed per open run
+// under that span. Filled pixels are closed in the map as they are taken.
+static SpanMask fillOpen(QVector<quint8> &open, int width, int height, const QPoint &seed)
+{
+    SpanMask mask(width, height);
+    QVector<QPoint> stack;
+    stack.append(seed);
+    while (!stack.isEmpty()) {
+        const QPoint point = stack.takeLast();
+        const int y = point.y();
+        quint8 *line = open.data() + qsizetype(y) * width;
+        if (!line[point.x()]) {
+            continue;
+        }
+
+        int left = point.x();
+        while (left > 0 && line[left - 1]) {
+            --left;
+        }
+        int right = point.x() + 1;
+        while (right < width && line[right]) {
+            ++right;
+        }
+        memset(line + left, 0, right - left);
+        mask.addSpan(y, left, right - left);
+
+        for (int next : {y - 1, y + 1}) {
+            if (next < 0 || next >= height) {
+                continue;
+            }
+            const quint8 *nextLine = open.constData() + qsizetype(next) * width;
+            for (int x = left; x < right; ++x) {
+                if (nextLine[x] && (x == left || !nextLine[x - 1])) {
+                    stack.append(QPoint(x, next));
+                }
+            }
+        }
+    }
+    return mask;
+}
+
+SpanMask floodFillSpans(const QImage &source, const QPoint &seed, const FillOptions &options)
+{
+    const int width = source.width();
+    const int height = source.height();
+    if (!source.rect().contains(seed)) {
+        return SpanMask(width, height);
+    }
+
+    QImage image = source;
+    if (image.format() != QImage::Format_ARGB32_Premultiplied
+        && image.format() != QImage::Format_ARGB32
+        && image.format() != QImage::Format_RGB32) {
+        image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    }
+
+    // Pixels the fill may cover, wherever they are
+    const QRgb target = reinterpret_cast<const QRgb*>(image.constScanLine(seed.y()))[seed.x()];
+    QVector<quint8> open(qsizetype(width) * height);
+    quint8 *openPixels = open.data();
+    parallelFor(height, [&](int y) {
+        matchColor(reinterpret_cast<const QRgb*>(image.constScanLine(y)), width, target, options.tolerance,
+                   openPixels + qsizetype(y) * width);
+    });
+
+    const int radius = (qMax(0, options.gapSize) + 1) / 2;
+    if (radius == 0) {
+        return fillOpen(open, width, height, seed);
+    }
+
+    // Erode: drop open pixels within radius of the outline, which closes
+    // every opening up to twice that wide
+    QVector<quint8> outline(open.size());
+    for (qsizetype i = 0; i < open.size(); ++i) {
+        outline[i] = !open[i];
+    }
+    const QVector<float> toOutline = squaredDistanceTransform(outline, width, height);
+    const float limit = float(radius) * radius;
+
+    QVector<quint8> core(open.size());
+    for (qsizetype i = 0; i < open.size(); ++i) {
+        core[i] = open[i] && toOutline[i] > limit;
+    }
+    if (!core[qsizetype(seed.y()) * width + seed.x()]) {
+        return fillOpen(open, width, height, seed);
+    }
+    const SpanMask coreMask = fillOpen(core, width, height, seed);
+
+    // Dilate the filled core back by the same radius, within the open area
+    QVector<quint8> filled(open.size(), 0);
+    for (int y = 0; y < height; ++y) {
+        quint8 *line = filled.data() + qsizetype(y) * width;
+        for (const Span &span : coreMask.spans(y)) {
+            memset(line + span.x, 1, span.length);
+        }
+    }
+    const QVector<float> toFilled = squaredDistanceTransform(filled, width, height);
+
+    SpanMask mask(width, height);
+    for (int y = 0; y < height; ++y) {
+        const qsizetype row = qsizetype(y) * width;
+        int x = 0;
+        while (x < width) {
+            if (!(open[row + x] && toFilled[row + x] <= limit)) {
+                ++x;
+                continue;
+            }
+            const int start = x;
+            while (x < width && open[row + x] && toFilled[row + x] <= limit) {
+                ++x;
+            }
+            mask.addSpan(y, start, x - start);
+        }
+    }
+    return mask;
+}
+
+void fillSpans(QImage &target, const SpanMask &mask, const QBrush &brush)
+{
+    if (mask.isEmpty() || brush.style() == Qt::NoBrush) {
+        return;
+    }
+
+    if (target.format() != QImage::Format_ARGB32_Premultiplied) {
+        QPainter painter(&target);
+        for (int y = mask.boundingRect().top(); y <= mask.boundingRect().bottom(); ++y) {
+            for (const Span &span : mask.spans(y)) {
+                painter.fillRect(span.x, y, span.length, 1, brush);
+            }
+        }
+        return;
+    }
+
+    // Brushes repeat vertically, so one band of a pattern period is rendered
+    // once and blended row by row through the spans
+    int period = 8; // Qt's built-in patterns
+    if (brush.style() == Qt::SolidPattern) {
+        period = 1;
+    } else if (brush.style() == Qt::TexturePattern) {
+        period = qMax(1, brush.textureImage().height());
+    }
+
+    QImage band(target.width(), period, QImage::Format_ARGB32_Premultiplied);
+    band.fill(Qt::transparent);
+    {
+        QPainter painter(&band);
+        painter.fillRect(band.rect(), brush);
+    }
+
+    const QRect bounds = mask.boundingRect() & target.rect();
+    for (int y = bounds.top(); y <= bounds.bottom(); ++y) {
+        const QRgb *src = reinterpret_cast<const QRgb*>(band.constScanLine(y % period));
+        QRgb *dst = reinterpret_cast<QRgb*>(target.scanLine(y));
+        for (const Span &span : mask.spans(y)) {
+            const int end = qMin(span.end(), target.width());
+            for (int x = qMax(span.x, 0); x < end; ++x) {
+                dst[x] = sourceOver(src[x], dst[x]);
+            }
+        }
+    }
+}
+
+} // namespace Unimalen
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "SpanMask.h"
+#include <QBrush>
+#include <QImage>
+#include <QPoint>
+
+namespace Unimalen {
+
+struct FillOptions
+{
+    int tolerance = 0; // Largest per-channel difference from the seed color, 0-255
+    int gapSize = 0;   // Openings in the outline up to this many pixels wide stop the fill
+};
+
+// Scanline flood fill of the 4-connected area of image around seed whose
+// color is within tolerance of the seed pixel.
+//
+// With a gap size, the area is first eroded by half of it using a distance
+// transform of the outline, which cuts narrow openings; the fill runs on
+// what is left and then grows back by the same distance, stopping at the
+// outline. Areas too narrow to survive the erosion are filled without it.
+SpanMask floodFillSpans(const QImage &image, const QPoint &seed, const FillOptions &options = FillOptions());
+
+// Paint brush over the masked pixels of target, as QPainter would with the
+// default source-over mode. The brush pattern is anchored at (0, 0).
+void fillSpans(QImage &target, const SpanMask &mask, const QBrush &brush);
+
+} // namespace Unimalen
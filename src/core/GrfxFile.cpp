@@ -0,0 +1,508 @@
+#include "GrfxFile.h"
+#include "Document.h"
+#include "PageSource.h"
+#include "Parallel.h"
+#include <QBuffer>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QSaveFile>
+
+namespace Unimalen {
+
+static const quint32 GRFX_MAGIC = 0x47524658; // "GRFX"
+static const quint32 GRFX_VERSION = 1;
+static const int GRFX_HEADER_SIZE = 24;
+static const int GRFX_THUMBNAIL_SIZE = 256;
+
+static QByteArray encodeHeader(quint64 indexOffset, quint64 indexSize)
+{
+    QByteArray header;
+    QDataStream stream(&header, QIODevice::WriteOnly);
+    stream << GRFX_MAGIC << GRFX_VERSION << indexOffset << indexSize;
+    return header;
+}
+
+static QByteArray compressTile(const QImage &tile)
+{
+    QByteArray raw;
+    raw.reserve(int(tile.sizeInBytes()));
+    const int rowBytes = tile.width() * 4;
+    for (int y = 0; y < tile.height(); ++y) {
+        raw.append(reinterpret_cast<const char*>(tile.constScanLine(y)), rowBytes);
+    }
+    return qCompress(raw);
+}
+
+static QImage decompressTile(const uchar *data, quint32 size, const QSize &tileSize)
+{
+    QByteArray raw = qUncompress(data, size);
+    const int rowBytes = tileSize.width() * 4;
+    if (raw.size() != rowBytes * tileSize.height()) {
+        return QImage();
+    }
+
+    QImage tile(tileSize, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < tileSize.height(); ++y) {
+        memcpy(tile.scanLine(y), raw.constData() + y * rowBytes, rowBytes);
+    }
+    return tile;
+}
+
+GrfxFile::GrfxFile(const QString &fileName)
+    : m_fileName(fileName)
+    , m_data(nullptr)
+    , m_size(0)
+{
+}
+
+bool GrfxFile::map()
+{
+    m_file.setFileName(m_fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    m_size = m_file.size();
+    m_data = m_file.map(0, m_size);
+    return m_data != nullptr;
+}
+
+void GrfxFile::unmap()
+{
+    m_file.close(); // Also unmaps
+    m_data = nullptr;
+    m_size = 0;
+}
+
+bool GrfxFile::open()
+{
+    QWriteLocker locker(&m_mapLock);
+    unmap();
+    if (!map() || m_size < GRFX_HEADER_SIZE) {
+        unmap();
+        return false;
+    }
+
+    QDataStream stream(QByteArray::fromRawData(reinterpret_cast<const char*>(m_data), GRFX_HEADER_SIZE));
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint64 indexOffset = 0;
+    quint64 indexSize = 0;
+    stream >> magic >> version >> indexOffset >> indexSize;
+    if (magic != GRFX_MAGIC || version != GRFX_VERSION || indexOffset + indexSize > quint64(m_size)) {
+        unmap();
+        return false;
+    }
+
+    Index index;
+    QByteArray data = qUncompress(m_data + indexOffset, qsizetype(indexSize));
+    if (!decodeIndex(data, index)) {
+        unmap();
+        return false;
+    }
+    m_index = index;
+    return true;
+}
+
+QByteArray GrfxFile::chunkData(const Chunk &chunk) const
+{
+    if (!m_data || chunk.size == 0 || chunk.offset + chunk.size > quint64(m_size)) {
+        return QByteArray();
+    }
+    return QByteArray(reinterpret_cast<const char*>(m_data + chunk.offset), int(chunk.size));
+}
+
+bool GrfxFile::loadPage(int pageIndex, Page &page)
+{
+    QReadLocker locker(&m_mapLock);
+    if (!m_data || pageIndex < 0 || pageIndex >= m_index.pages.size()
+        || page.width() != m_index.width || page.height() != m_index.height) {
+        return false;
+    }
+
+    const PageEntry &entry = m_index.pages.at(pageIndex);
+    QList<Layer> layers;
+    for (const LayerEntry &layerEntry : entry.layers) {
+        Layer layer(layerEntry.name, m_index.width, m_index.height);
+        layer.setVisible(layerEntry.visible);
+        layer.setOpacity(layerEntry.opacity);
+        layer.setBlendMode(Layer::BlendMode(layerEntry.blendMode));
+        if (layerEntry.tiles.size() != layer.tileCount()) {
+            return false;
+        }
+        layers.append(layer);
+    }
+
+    // Tiles decompress independently, spread them over the pool
+    QVector<QPair<int, int>> work;
+    for (int l = 0; l < entry.layers.size(); ++l) {
+        for (int t = 0; t < entry.layers[l].tiles.size(); ++t) {
+            if (entry.layers[l].tiles[t].size > 0) {
+                work.append(qMakePair(l, t));
+            }
+        }
+    }
+
+    QVector<QImage> tiles(work.size());
+    QImage *decoded = tiles.data();
+    parallelFor(work.size(), [&](int i) {
+        const Chunk &chunk = entry.layers[work[i].first].tiles[work[i].second];
+        if (chunk.offset + chunk.size <= quint64(m_size)) {
+            QSize tileSize = layers.at(work[i].first).tileRect(work[i].second).size();
+            decoded[i] = decompressTile(m_data + chunk.offset, chunk.size, tileSize);
+        }
+    });
+
+    QMutexLocker chunkLocker(&m_chunkMutex);
+    for (int i = 0; i < work.size(); ++i) {
+        if (tiles[i].isNull()) {
+            return false;
+        }
+        layers[work[i].first].setTile(work[i].second, tiles[i]);
+        m_tileChunks.insert(tiles[i].cacheKey(), entry.layers[work[i].first].tiles[work[i].second]);
+    }
+
+    page.setPaperColor(PaperColor(m_index.paperColor));
+    page.layers() = layers;
+    page.setCurrentLayerIndex(entry.currentLayer);
+    m_thumbnailChunks.insert(page.generation(), entry.thumbnail);
+    return true;
+}
+
+QImage GrfxFile::thumbnail(int pageIndex)
+{
+    QReadLocker locker(&m_mapLock);
+    if (pageIndex < 0 || pageIndex >= m_index.pages.size()) {
+        return QImage();
+    }
+    return QImage::fromData(chunkData(m_index.pages.at(pageIndex).thumbnail), "PNG");
+}
+
+QByteArray GrfxFile::encodeIndex(const Index &index)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << index.width << index.height << index.paperColor << index.currentPage
+           << qint32(index.pages.size());
+    for (const PageEntry &page : index.pages) {
+        stream << page.thumbnail.offset << page.thumbnail.size
+               << page.currentLayer << qint32(page.layers.size());
+        for (const LayerEntry &layer : page.layers) {
+            stream << layer.name << layer.visible << layer.opacity << layer.blendMode
+                   << qint32(layer.tiles.size());
+            for (const Chunk &chunk : layer.tiles) {
+                stream << chunk.offset << chunk.size;
+            }
+        }
+    }
+    return qCompress(data);
+}
+
+bool GrfxFile::decodeIndex(const QByteArray &data, Index &index)
+{
+    QDataStream stream(data);
+    qint32 pageCount = 0;
+    stream >> index.width >> index.height >> index.paperColor >> index.currentPage >> pageCount;
+    if (stream.status() != QDataStream::Ok || index.width <= 0 || index.height <= 0
+        || pageCount <= 0 || pageCount > MAX_PAGES) {
+        return false;
+    }
+
+    index.pages.resize(pageCount);
+    for (PageEntry &page : index.pages) {
+        qint32 layerCount = 0;
+        stream >> page.thumbnail.offset >> page.thumbnail.size >> page.currentLayer >> layerCount;
+        if (stream.status() != QDataStream::Ok || layerCount <= 0 || layerCount > MAX_LAYERS_PER_PAGE) {
+            return false;
+        }
+
+        page.layers.resize(layerCount);
+        for (LayerEntry &layer : page.layers) {
+            qint32 tileCount = 0;
+            stream >> layer.name >> layer.visible >> layer.opacity >> layer.blendMode >> tileCount;
+            if (stream.status() != QDataStream::Ok || tileCount < 0 || tileCount > data.size()) {
+                return false;
+            }
+            layer.tiles.resize(tileCount);
+            for (Chunk &chunk : layer.tiles) {
+                stream >> chunk.offset >> chunk.size;
+            }
+        }
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
+bool GrfxFile::save(const Document &document)
+{
+    // Lay out the index first, chunk offsets are filled in below
+    Index index;
+    index.width = document.width();
+    index.height = document.height();
+    index.paperColor = qint32(document.paperColor());
+    index.currentPage = document.currentPageIndex();
+    index.pages.resize(document.pageCount());
+
+    // Pages not decoded since they were read from this file keep their
+    // entries and chunks as they are. Anything else pending is loaded and
+    // flushed here, before any lock is taken: loading may run loadPage() on
+    // this file, or wait for a prefetch that does.
+    QVector<int> passed(document.pageCount(), -1);
+    QVector<const Page*> pages(document.pageCount(), nullptr);
+    const bool sameLayout = m_data && index.width == m_index.width && index.height == m_index.height
+                            && index.paperColor == m_index.paperColor;
+    for (int i = 0; i < document.pageCount(); ++i) {
+        const PageSource *source = document.pages().at(i).source();
+        if (sameLayout && source && source->owner() == this
+            && source->originIndex() >= 0 && source->originIndex() < m_index.pages.size()) {
+            passed[i] = source->originIndex();
+            index.pages[i] = m_index.pages.at(passed[i]);
+        }
+    }
+
+    for (int i = 0; i < document.pageCount(); ++i) {
+        if (passed[i] >= 0) {
+            continue;
+        }
+        const Page &page = document.pageAt(i);
+        page.flush();
+        pages[i] = &page;
+        PageEntry &pageEntry = index.pages[i];
+        pageEntry.currentLayer = page.currentLayerIndex();
+        pageEntry.layers.resize(page.layers().size());
+        for (int l = 0; l < page.layers().size(); ++l) {
+            const Layer &layer = page.layers()[l];
+            LayerEntry &layerEntry = pageEntry.layers[l];
+            layerEntry.name = layer.name();
+            layerEntry.visible = layer.isVisible();
+            layerEntry.opacity = layer.opacity();
+            layerEntry.blendMode = qint32(layer.blendMode());
+            layerEntry.tiles.resize(layer.tileCount());
+        }
+    }
+
+    // Chunks already in the file are reused, the rest are encoded. Tiles
+    // and thumbnails that occur more than once (duplicated layers or pages)
+    // are stored once and aliased. Everything points into index, which is
+    // not resized from here on.
+    struct Job {
+        Chunk *target;
+        const Page *page;
+        const Layer *layer; // Null for page thumbnails
+        int tile;
+    };
+    QVector<Job> jobs;
+    QVector<Chunk*> reused;
+    QVector<QPair<Chunk*, Chunk*>> aliases;
+    QHash<qint64, Chunk*> tileTargets;
+    QHash<quint64, Chunk*> thumbnailTargets;
+    QHash<quint64, Chunk*> passedTargets; // By offset in the file
+    QHash<qint64, Chunk> tileChunks;
+    QHash<quint64, Chunk> thumbnailChunks;
+    {
+        // Copied so the lock is not held while pages are looked at
+        QMutexLocker chunkLocker(&m_chunkMutex);
+        tileChunks = m_tileChunks;
+        thumbnailChunks = m_thumbnailChunks;
+    }
+    for (int i = 0; i < document.pageCount(); ++i) {
+        if (passed[i] >= 0) {
+            PageEntry &pageEntry = index.pages[i];
+            QVector<Chunk*> chunks;
+            chunks.append(&pageEntry.thumbnail);
+            for (LayerEntry &layerEntry : pageEntry.layers) {
+                for (Chunk &chunk : layerEntry.tiles) {
+                    chunks.append(&chunk);
+                }
+            }
+            for (Chunk *chunk : chunks) {
+                if (chunk->size == 0) {
+                    continue;
+                }
+                if (passedTargets.contains(chunk->offset)) {
+                    aliases.append(qMakePair(chunk, passedTargets.value(chunk->offset)));
+                } else {
+                    reused.append(chunk);
+                    passedTargets.insert(chunk->offset, chunk);
+                }
+            }
+            continue;
+        }
+
+        const Page &page = *pages[i];
+        PageEntry &pageEntry = index.pages[i];
+
+        const quint64 key = page.generation();
+        auto thumbnail = thumbnailChunks.constFind(key);
+        if (thumbnailTargets.contains(key)) {
+            aliases.append(qMakePair(&pageEntry.thumbnail, thumbnailTargets.value(key)));
+        } else {
+            if (m_data && thumbnail != thumbnailChunks.constEnd()) {
+                pageEntry.thumbnail = thumbnail.value();
+                reused.append(&pageEntry.thumbnail);
+            } else {
+                jobs.append({&pageEntry.thumbnail, &page, nullptr, 0});
+            }
+            thumbnailTargets.insert(key, &pageEntry.thumbnail);
+        }
+
+        for (int l = 0; l < page.layers().size(); ++l) {
+            const Layer &layer = page.layers()[l];
+            for (int t = 0; t < layer.tileCount(); ++t) {
+                const QImage &tile = layer.tileAt(t);
+                if (tile.isNull()) {
+                    continue;
+                }
+                Chunk *target = &pageEntry.layers[l].tiles[t];
+                if (tileTargets.contains(tile.cacheKey())) {
+                    aliases.append(qMakePair(target, tileTargets.value(tile.cacheKey())));
+                    continue;
+                }
+                auto chunk = tileChunks.constFind(tile.cacheKey());
+                if (m_data && chunk != tileChunks.constEnd()) {
+                    *target = chunk.value();
+                    reused.append(target);
+                } else {
+                    jobs.append({target, &page, &layer, t});
+                }
+                tileTargets.insert(tile.cacheKey(), target);
+            }
+        }
+    }
+
+    QVector<QByteArray> encoded(jobs.size());
+    QByteArray *results = encoded.data();
+    parallelFor(jobs.size(), [&](int i) {
+        const Job &job = jobs.at(i);
+        if (job.layer) {
+            results[i] = compressTile(job.layer->tileAt(job.tile));
+        } else {
+            QImage thumbnail = job.page->composite()
+                .scaled(GRFX_THUMBNAIL_SIZE, GRFX_THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            QBuffer buffer(&results[i]);
+            buffer.open(QIODevice::WriteOnly);
+            thumbnail.save(&buffer, "PNG");
+        }
+    });
+
+    QVector<Chunk*> targets;
+    targets.reserve(jobs.size() + reused.size());
+    qint64 newBytes = 0;
+    for (int i = 0; i < jobs.size(); ++i) {
+        targets.append(jobs[i].target);
+        newBytes += encoded[i].size();
+    }
+    qint64 liveBytes = GRFX_HEADER_SIZE + newBytes;
+    for (const Chunk *chunk : reused) {
+        liveBytes += chunk->size;
+    }
+
+    // Append to the file while at most half of it would be dead weight,
+    // otherwise write it out compacted
+    QWriteLocker locker(&m_mapLock);
+    bool appended = false;
+    if (m_data && QFileInfo(m_fileName).size() == m_size && m_size + newBytes <= 2 * liveBytes) {
+        appended = writeAppended(index, encoded, targets, aliases);
+    }
+    if (!appended) {
+        QVector<QByteArray> chunks = encoded;
+        for (Chunk *chunk : reused) {
+            chunks.append(chunkData(*chunk));
+            targets.append(chunk);
+        }
+        if (!writeFull(index, chunks, targets, aliases)) {
+            return false;
+        }
+    }
+
+    // Remember where everything went for the next save
+    {
+        QMutexLocker chunkLocker(&m_chunkMutex);
+        m_tileChunks.clear();
+        for (auto it = tileTargets.constBegin(); it != tileTargets.constEnd(); ++it) {
+            m_tileChunks.insert(it.key(), *it.value());
+        }
+        m_thumbnailChunks.clear();
+        for (auto it = thumbnailTargets.constBegin(); it != thumbnailTargets.constEnd(); ++it) {
+            m_thumbnailChunks.insert(it.key(), *it.value());
+        }
+    }
+
+    m_index = index;
+    unmap();
+    if (!map()) {
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+bool GrfxFile::writeFull(const Index &index, const QVector<QByteArray> &pending,
+                         const QVector<Chunk*> &targets, const QVector<QPair<Chunk*, Chunk*>> &aliases)
+{
+    quint64 offset = GRFX_HEADER_SIZE;
+    for (int i = 0; i < targets.size(); ++i) {
+        if (pending[i].isEmpty()) {
+            return false;
+        }
+        targets[i]->offset = offset;
+        targets[i]->size = quint32(pending[i].size());
+        offset += pending[i].size();
+    }
+    for (const auto &alias : aliases) {
+        *alias.first = *alias.second;
+    }
+    QByteArray indexData = encodeIndex(index);
+
+    // The old mapping is dropped before the file is replaced
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(encodeHeader(offset, indexData.size()));
+    for (const QByteArray &chunk : pending) {
+        file.write(chunk);
+    }
+    file.write(indexData);
+
+    unmap();
+    return file.commit();
+}
+
+bool GrfxFile::writeAppended(const Index &index, const QVector<QByteArray> &pending,
+                             const QVector<Chunk*> &targets, const QVector<QPair<Chunk*, Chunk*>> &aliases)
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+
+    // New chunks and the index go after everything that is there now, so
+    // the old index stays valid until the header is repointed
+    quint64 offset = quint64(m_size);
+    for (int i = 0; i < targets.size(); ++i) {
+        if (pending[i].isEmpty()) {
+            return false;
+        }
+        targets[i]->offset = offset;
+        targets[i]->size = quint32(pending[i].size());
+        offset += pending[i].size();
+    }
+    for (const auto &alias : aliases) {
+        *alias.first = *alias.second;
+    }
+    QByteArray indexData = encodeIndex(index);
+
+    QByteArray tail;
+    for (const QByteArray &chunk : pending) {
+        tail += chunk;
+    }
+    tail += indexData;
+
+    if (!file.seek(m_size) || file.write(tail) != tail.size() || !file.flush()) {
+        return false;
+    }
+
+    QByteArray header = encodeHeader(offset, indexData.size());
+    return file.seek(0) && file.write(header) == header.size() && file.flush();
+}
+
+} // namespace Unimalen
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QString>
+#include <QVector>
+
+namespace Unimalen {
+
+class Document;
+class Page;
+
+// Native single-file document format (.grfx). The file is a header, a heap
+// of chunks (zlib-compressed raw tiles and PNG page thumbnails) and an index
+// of every page, layer and tile chunk:
+//
+//   header   magic, version, index offset and size
+//   chunks   in any order, possibly with unreferenced gaps
+//   index    compressed, usually at the end
+//
+// Opened files stay memory mapped and pages are decoded from the mapping on
+// demand. Saving back to the same file appends only the chunks that changed
+// and then repoints the header at a new index; the file is rewritten from
+// scratch once more than half of it is unreferenced.
+class GrfxFile
+{
+public:
+    explicit GrfxFile(const QString &fileName);
+
+    QString fileName() const { return m_fileName; }
+
+    // Map the file and read its index
+    bool open();
+    int pageCount() const { return m_index.pages.size(); }
+
+    // Document properties from the index
+    int width() const { return m_index.width; }
+    int height() const { return m_index.height; }
+    int paperColor() const { return m_index.paperColor; }
+    int currentPage() const { return m_index.currentPage; }
+
+    // Decode a page into page, which must have the document size. Safe to
+    // call from several threads.
+    bool loadPage(int pageIndex, Page &page);
+    QImage thumbnail(int pageIndex);
+
+    // Write document to this file. Pages still pending from this file are
+    // copied over as they are, other pending pages are loaded.
+    bool save(const Document &document);
+
+private:
+    struct Chunk {
+        quint64 offset = 0;
+        quint32 size = 0; // 0 for fully transparent tiles
+    };
+    struct LayerEntry {
+        QString name;
+        bool visible = true;
+        qreal opacity = 1.0;
+        qint32 blendMode = 0;
+        QVector<Chunk> tiles;
+    };
+    struct PageEntry {
+        Chunk thumbnail;
+        qint32 currentLayer = 0;
+        QVector<LayerEntry> layers;
+    };
+    struct Index {
+        qint32 width = 0;
+        qint32 height = 0;
+        qint32 paperColor = 0;
+        qint32 currentPage = 0;
+        QVector<PageEntry> pages;
+    };
+
+    bool map();
+    void unmap();
+    QByteArray chunkData(const Chunk &chunk) const;
+    // Assign offsets to targets (in the order of pending), resolve aliases
+    // (target, source) and write the chunks and the index
+    bool writeFull(const Index &index, const QVector<QByteArray> &pending,
+                   const QVector<Chunk*> &targets, const QVector<QPair<Chunk*, Chunk*>> &aliases);
+    bool writeAppended(const Index &index, const QVector<QByteArray> &pending,
+                       const QVector<Chunk*> &targets, const QVector<QPair<Chunk*, Chunk*>> &aliases);
+    static QByteArray encodeIndex(const Index &index);
+    static bool decodeIndex(const QByteArray &data, Index &index);
+
+    QString m_fileName;
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_size;
+    Index m_index;
+
+    // Serializes remapping after a save against pages decoding from the map
+    QReadWriteLock m_mapLock;
+
+    // Chunks already in the file, by the tile (cache key) or page
+    // generation they hold, so saves only write what changed
+    QMutex m_chunkMutex;
+    QHash<qint64, Chunk> m_tileChunks;
+    QHash<quint64, Chunk> m_thumbnailChunks;
+};
+
+} // namespace Unimalen
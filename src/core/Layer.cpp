@@ -1,32 +1,71 @@
 #include "Layer.h"
+#include "BlendKernels.h"
 #include <QPainter>
+#include <atomic>
+#include <cstring>
 
 namespace Unimalen {
 
+static quint64 nextLayerId()
+{
+    static std::atomic<quint64> counter{0};
+    return ++counter;
+}
+
+static quint64 nextGeneration()
+{
+    static std::atomic<quint64> counter{0};
+    return ++counter;
+}
+
 Layer::Layer(const QString &name, int width, int height)
-    : m_name(name)
-    , m_pixmap(width, height)
+    : m_id(nextLayerId())
+    , m_generation(nextGeneration())
+    , m_name(name)
+    , m_width(width)
+    , m_height(height)
+    , m_tileColumns(0)
+    , m_tileRows(0)
+    , m_surfaceDirty(false)
     , m_visible(true)
     , m_opacity(1.0)
     , m_blendMode(Normal)
 {
-    m_pixmap.fill(Qt::transparent);
+    initTiles();
 }
 
 Layer::Layer(const Layer &other)
-    : m_name(other.m_name)
-    , m_pixmap(other.m_pixmap)
+    : m_id(other.m_id)
+    , m_generation(other.m_generation)
+    , m_name(other.m_name)
+    , m_width(other.m_width)
+    , m_height(other.m_height)
+    , m_tileColumns(other.m_tileColumns)
+    , m_tileRows(other.m_tileRows)
+    , m_surfaceDirty(false)
     , m_visible(other.m_visible)
     , m_opacity(other.m_opacity)
     , m_blendMode(other.m_blendMode)
 {
+    // Copies take the tiles only, never the editing surface
+    other.flush();
+    m_tiles = other.m_tiles;
 }
 
 Layer& Layer::operator=(const Layer &other)
 {
     if (this != &other) {
+        other.flush();
+        m_id = other.m_id;
+        m_generation = other.m_generation;
         m_name = other.m_name;
-        m_pixmap = other.m_pixmap;
+        m_width = other.m_width;
+        m_height = other.m_height;
+        m_tileColumns = other.m_tileColumns;
+        m_tileRows = other.m_tileRows;
+        m_tiles = other.m_tiles;
+        m_surface = QImage();
+        m_surfaceDirty = false;
         m_visible = other.m_visible;
         m_opacity = other.m_opacity;
         m_blendMode = other.m_blendMode;
@@ -34,32 +73,246 @@ Layer& Layer::operator=(const Layer &other)
     return *this;
 }
 
+void Layer::initTiles()
+{
+    m_tileColumns = (m_width + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+    m_tileRows = (m_height + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+    m_tiles = QVector<QImage>(m_tileColumns * m_tileRows);
+}
+
+QRect Layer::tileRect(int index) const
+{
+    int x = (index % m_tileColumns) * LAYER_TILE_SIZE;
+    int y = (index / m_tileColumns) * LAYER_TILE_SIZE;
+    return QRect(x, y, qMin(LAYER_TILE_SIZE, m_width - x), qMin(LAYER_TILE_SIZE, m_height - y));
+}
+
+const QImage& Layer::tileAt(int index) const
+{
+    flush();
+    return m_tiles.at(index);
+}
+
+QVector<QImage> Layer::tiles() const
+{
+    flush();
+    return m_tiles;
+}
+
+void Layer::setTile(int index, const QImage &tile)
+{
+    if (index < 0 || index >= m_tiles.size()) {
+        return;
+    }
+
+    if (!m_surface.isNull()) {
+        // Keep a live surface in step so it does not need to be rebuilt
+        flush();
+        QRect rect = tileRect(index);
+        QPainter painter(&m_surface);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        if (tile.isNull()) {
+            painter.fillRect(rect, Qt::transparent);
+        } else {
+            painter.drawImage(rect.topLeft(), tile);
+        }
+    }
+
+    m_tiles[index] = tile;
+    m_generation = nextGeneration();
+}
+
+int Layer::nonEmptyTileCount() const
+{
+    flush();
+    int count = 0;
+    for (const QImage &tile : m_tiles) {
+        if (!tile.isNull()) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool Layer::isTransparent(const QImage &image, const QRect &rect)
+{
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const QRgb *line = reinterpret_cast<const QRgb*>(image.constScanLine(y)) + rect.left();
+        for (int x = 0; x < rect.width(); ++x) {
+            if (qAlpha(line[x]) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool Layer::matchesTile(const QImage &image, const QRect &rect, const QImage &tile)
+{
+    const size_t rowBytes = size_t(rect.width()) * sizeof(QRgb);
+    for (int y = 0; y < rect.height(); ++y) {
+        const uchar *line = image.constScanLine(rect.top() + y) + rect.left() * sizeof(QRgb);
+        if (memcmp(line, tile.constScanLine(y), rowBytes) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+quint64 Layer::generation() const
+{
+    flush();
+    return m_generation;
+}
+
+void Layer::setTilesFromImage(const QImage &image) const
+{
+    bool changed = false;
+    for (int i = 0; i < m_tiles.size(); ++i) {
+        QRect rect = tileRect(i);
+
+        if (image.rect().contains(rect)) {
+            // Unchanged tiles keep their data, so tiles shared with a
+            // duplicated layer or page stay shared
+            const QImage &current = m_tiles[i];
+            if (current.isNull() ? isTransparent(image, rect) : matchesTile(image, rect, current)) {
+                continue;
+            }
+            m_tiles[i] = isTransparent(image, rect) ? QImage() : image.copy(rect);
+        } else {
+            // Out-of-bounds areas of copy() come back transparent, so a
+            // surface of a different size is clipped to the layer bounds
+            QImage tile = image.copy(rect);
+            m_tiles[i] = isTransparent(tile, tile.rect()) ? QImage() : tile;
+        }
+        changed = true;
+    }
+
+    if (changed) {
+        m_generation = nextGeneration();
+    }
+}
+
+QImage& Layer::image()
+{
+    if (m_surface.isNull()) {
+        m_surface = QImage(m_width, m_height, QImage::Format_ARGB32_Premultiplied);
+        m_surface.fill(Qt::transparent);
+
+        QPainter painter(&m_surface);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        for (int i = 0; i < m_tiles.size(); ++i) {
+            if (!m_tiles[i].isNull()) {
+                painter.drawImage(tileRect(i).topLeft(), m_tiles[i]);
+            }
+        }
+    }
+
+    // The caller may paint on the surface, so the tiles are stale until flushed
+    m_surfaceDirty = true;
+    return m_surface;
+}
+
+void Layer::setImage(const QImage &image)
+{
+    m_surface = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    m_surfaceDirty = true;
+}
+
+void Layer::flush() const
+{
+    if (m_surface.isNull() || !m_surfaceDirty) {
+        return;
+    }
+
+    // No-op when the surface is already premultiplied, which is the normal case
+    setTilesFromImage(m_surface.convertToFormat(QImage::Format_ARGB32_Premultiplied));
+    m_surfaceDirty = false;
+}
+
+void Layer::releaseSurface()
+{
+    flush();
+    m_surface = QImage();
+    m_surfaceDirty = false;
+}
+
+QImage Layer::toImage() const
+{
+    flush();
+
+    QImage image(m_width, m_height, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    QPainter painter(&image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for (int i = 0; i < m_tiles.size(); ++i) {
+        if (!m_tiles[i].isNull()) {
+            painter.drawImage(tileRect(i).topLeft(), m_tiles[i]);
+        }
+    }
+    return image;
+}
+
+QImage Layer::thumbnail(const QSize &size) const
+{
+    QSize scaledSize = this->size().scaled(size, Qt::KeepAspectRatio);
+    QImage image(scaledSize, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    if (scaledSize.isEmpty()) {
+        return image;
+    }
+
+    flush();
+
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.scale(qreal(scaledSize.width()) / m_width, qreal(scaledSize.height()) / m_height);
+    for (int i = 0; i < m_tiles.size(); ++i) {
+        if (!m_tiles[i].isNull()) {
+            painter.drawImage(tileRect(i).topLeft(), m_tiles[i]);
+        }
+    }
+    return image;
+}
+
 void Layer::clear()
 {
-    m_pixmap.fill(Qt::transparent);
+    m_surface = QImage();
+    m_surfaceDirty = false;
+    initTiles();
+    m_generation = nextGeneration();
 }
 
 void Layer::resize(int width, int height)
 {
-    if (m_pixmap.size() != QSize(width, height)) {
-        QPixmap newPixmap(width, height);
-        newPixmap.fill(Qt::transparent);
+    if (size() != QSize(width, height)) {
+        QImage content = toImage();
 
-        QPainter painter(&newPixmap);
-        painter.drawPixmap(0, 0, m_pixmap);
-
-        m_pixmap = newPixmap;
+        m_width = width;
+        m_height = height;
+        m_surface = QImage();
+        m_surfaceDirty = false;
+        initTiles();
+        setTilesFromImage(content);
+        m_generation = nextGeneration();
     }
 }
 
 Layer Layer::duplicate() const
 {
     Layer copy(*this);
+    copy.m_id = nextLayerId();
     copy.setName(m_name + " copy");
     return copy;
 }
 
 void Layer::compositeTo(QPainter &painter) const
+{
+    compositeTo(painter, QRect(0, 0, m_width, m_height));
+}
+
+void Layer::compositeTo(QPainter &painter, const QRect &rect) const
 {
     if (!m_visible || m_opacity <= 0.0) {
         return;
@@ -91,10 +344,100 @@ void Layer::compositeTo(QPainter &painter) const
     QPainter::CompositionMode oldMode = painter.compositionMode();
     painter.setCompositionMode(compositionMode);
 
-    painter.drawPixmap(0, 0, m_pixmap);
+    if (!m_surface.isNull()) {
+        // Layer is being edited, draw straight from the live surface
+        painter.drawImage(rect.topLeft(), m_surface, rect);
+    } else {
+        // Only visit the non-empty tiles that intersect the requested area
+        QRect area = rect.intersected(QRect(0, 0, m_width, m_height));
+        if (!area.isEmpty()) {
+            int firstColumn = area.left() / LAYER_TILE_SIZE;
+            int lastColumn = area.right() / LAYER_TILE_SIZE;
+            int firstRow = area.top() / LAYER_TILE_SIZE;
+            int lastRow = area.bottom() / LAYER_TILE_SIZE;
+
+            for (int row = firstRow; row <= lastRow; ++row) {
+                for (int column = firstColumn; column <= lastColumn; ++column) {
+                    int index = row * m_tileColumns + column;
+                    const QImage &tile = m_tiles.at(index);
+                    if (tile.isNull()) {
+                        continue;
+                    }
+                    QRect tileArea = tileRect(index);
+                    QRect part = tileArea.intersected(area);
+                    painter.drawImage(part.topLeft(), tile, part.translated(-tileArea.topLeft()));
+                }
+            }
+        }
+    }
 
     painter.setCompositionMode(oldMode);
     painter.setOpacity(oldOpacity);
 }
 
-} // namespace Unimalen
\ No newline at end of file
+// Blend part of source (source coordinates) onto target at targetPos
+static void blendImage(QImage &target, const QPoint &targetPos, const QImage &source, const QRect &part,
+                       Layer::BlendMode mode, int opacity)
+{
+    QImage converted;
+    const QImage *pixels = &source;
+    if (source.format() != QImage::Format_ARGB32_Premultiplied) {
+        converted = source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        pixels = &converted;
+    }
+
+    for (int y = 0; y < part.height(); ++y) {
+        const QRgb *src = reinterpret_cast<const QRgb*>(pixels->constScanLine(part.top() + y)) + part.left();
+        QRgb *dst = reinterpret_cast<QRgb*>(target.scanLine(targetPos.y() + y)) + targetPos.x();
+        blendRow(mode, src, dst, part.width(), opacity);
+    }
+}
+
+void Layer::blendTo(QImage &target, const QRect &rect, const QPoint &origin) const
+{
+    if (!m_visible || m_opacity <= 0.0) {
+        return;
+    }
+
+    if (target.format() != QImage::Format_ARGB32_Premultiplied) {
+        QPainter painter(&target);
+        painter.translate(-origin);
+        compositeTo(painter, rect);
+        return;
+    }
+
+    QRect area = rect.intersected(QRect(0, 0, m_width, m_height)).intersected(target.rect().translated(origin));
+    if (area.isEmpty()) {
+        return;
+    }
+    const int opacity = qRound(m_opacity * 255);
+
+    if (!m_surface.isNull()) {
+        // Layer is being edited, blend straight from the live surface
+        area = area.intersected(m_surface.rect());
+        if (!area.isEmpty()) {
+            blendImage(target, area.topLeft() - origin, m_surface, area, m_blendMode, opacity);
+        }
+        return;
+    }
+
+    int firstColumn = area.left() / LAYER_TILE_SIZE;
+    int lastColumn = area.right() / LAYER_TILE_SIZE;
+    int firstRow = area.top() / LAYER_TILE_SIZE;
+    int lastRow = area.bottom() / LAYER_TILE_SIZE;
+
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            int index = row * m_tileColumns + column;
+            const QImage &tile = m_tiles.at(index);
+            if (tile.isNull()) {
+                continue;
+            }
+            QRect tileArea = tileRect(index);
+            QRect part = tileArea.intersected(area);
+            blendImage(target, part.topLeft() - origin, tile, part.translated(-tileArea.topLeft()), m_blendMode, opacity);
+        }
+    }
+}
+
+} // namespace Unimalen
@@ -1,11 +1,15 @@
 #pragma once
 
-#include <QPixmap>
+#include <QImage>
+#include <QVector>
 #include <QString>
 #include <QPainter>
 
 namespace Unimalen {
 
+// Edge length of the square tiles layer pixels are stored in
+constexpr int LAYER_TILE_SIZE = 64;
+
 class Layer
 {
 public:
@@ -18,7 +22,16 @@ public:
 
     explicit Layer(const QString &name = "Layer", int width = 576, int height = 720);
     Layer(const Layer &other);
+    Layer(Layer &&other) = default;
     Layer& operator=(const Layer &other);
+    Layer& operator=(Layer &&other) = default;
+
+    // Identity that survives copies and reordering; duplicate() gets a new one
+    quint64 id() const { return m_id; }
+
+    // Changes whenever the pixels change. Values are unique across all
+    // layers, so equal generations always mean equal content.
+    quint64 generation() const;
 
     // Layer properties
     QString name() const { return m_name; }
@@ -33,9 +46,36 @@ public:
     BlendMode blendMode() const { return m_blendMode; }
     void setBlendMode(BlendMode mode) { m_blendMode = mode; }
 
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    QSize size() const { return QSize(m_width, m_height); }
+
     // Layer content
-    QPixmap& pixmap() { return m_pixmap; }
-    const QPixmap& pixmap() const { return m_pixmap; }
+    // Pixels are kept in sparse tiles. image() materializes a page-sized
+    // ARGB32_Premultiplied editing surface on demand; it is folded back into
+    // tiles by flush() and dropped again by releaseSurface().
+    QImage& image();
+    void setImage(const QImage &image);
+    bool hasSurface() const { return !m_surface.isNull(); }
+    void flush() const;
+    void releaseSurface();
+
+    // Flattened copies rendered from the non-empty tiles only
+    QImage toImage() const;
+    QImage thumbnail(const QSize &size) const;
+
+    // Tile access, fully transparent tiles are null images. Tiles are
+    // implicitly shared between copies of a layer and only detach once
+    // their pixels actually change.
+    int tileColumns() const { return m_tileColumns; }
+    int tileRows() const { return m_tileRows; }
+    int tileCount() const { return m_tiles.size(); }
+    QRect tileRect(int index) const;
+    const QImage& tileAt(int index) const;
+    QVector<QImage> tiles() const;
+    void setTile(int index, const QImage &tile);
+    int nonEmptyTileCount() const;
+    bool isEmpty() const { return nonEmptyTileCount() == 0; }
 
     // Layer operations
     void clear();
@@ -44,13 +84,32 @@ public:
 
     // Composite this layer onto target with current settings
     void compositeTo(QPainter &painter) const;
+    // Composite only the given rectangle (layer coordinates) onto target
+    void compositeTo(QPainter &painter, const QRect &rect) const;
+    // Same for an ARGB32_Premultiplied target, blended straight on its
+    // scanlines with the row kernels in BlendKernels.h. The target's top
+    // left pixel is the layer's pixel at origin, so it can be a band.
+    void blendTo(QImage &target, const QRect &rect, const QPoint &origin = QPoint()) const;
 
 private:
+    void initTiles();
+    void setTilesFromImage(const QImage &image) const;
+    static bool isTransparent(const QImage &image, const QRect &rect);
+    static bool matchesTile(const QImage &image, const QRect &rect, const QImage &tile);
+
+    quint64 m_id;
+    mutable quint64 m_generation;
     QString m_name;
-    QPixmap m_pixmap;
+    int m_width;
+    int m_height;
+    int m_tileColumns;
+    int m_tileRows;
+    mutable QVector<QImage> m_tiles;
+    QImage m_surface;
+    mutable bool m_surfaceDirty;
     bool m_visible;
     qreal m_opacity;
     BlendMode m_blendMode;
 };
 
-} // namespace Unimalen
\ No newline at end of file
+} // namespace Unimalen
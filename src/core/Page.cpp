@@ -1,13 +1,24 @@
 #include "Page.h"
-#include <QPainter>
+#include "PageSource.h"
+#include "BlendKernels.h"
+#include "Parallel.h"
+#include <atomic>
+#include <cstring>
 
 namespace Unimalen {
 
+static quint64 nextGeneration()
+{
+    static std::atomic<quint64> counter{0};
+    return ++counter;
+}
+
 Page::Page(int width, int height, PaperColor paperColor)
     : m_width(width)
     , m_height(height)
     , m_paperColor(paperColor)
     , m_currentLayerIndex(0)
+    , m_generation(0)
 {
     // Create initial layer
     addLayer("Layer 1");
@@ -16,10 +27,35 @@ Page::Page(int width, int height, PaperColor paperColor)
 void Page::setCurrentLayerIndex(int index)
 {
     if (index >= 0 && index < m_layers.size()) {
+        if (index != m_currentLayerIndex) {
+            releaseSurfaces();
+        }
         m_currentLayerIndex = index;
     }
 }
 
+void Page::releaseSurfaces()
+{
+    for (Layer &layer : m_layers) {
+        layer.releaseSurface();
+    }
+    m_below = FlattenedStack();
+    m_above = FlattenedStack();
+}
+
+void Page::flush() const
+{
+    for (const Layer &layer : m_layers) {
+        layer.flush();
+    }
+}
+
+void Page::detachLayers()
+{
+    // Copying a layer flushes it and takes its tiles only
+    m_layers.detach();
+}
+
 Layer& Page::currentLayer()
 {
     if (m_layers.isEmpty()) {
@@ -112,31 +148,205 @@ void Page::setLayerName(int index, const QString &name)
     }
 }
 
-QPixmap Page::composite() const
+quint64 Page::generation() const
+{
+    // Layers are edited in place through layers() and image(), so the
+    // state is compared on demand rather than bumped by every mutator
+    QVector<quint64> key = stackKey(0, m_layers.size());
+    key << quint64(m_width) << quint64(m_height) << quint64(getPaperColorValue(m_paperColor).rgba());
+    if (m_generation == 0 || key != m_generationKey) {
+        m_generationKey = key;
+        m_generation = nextGeneration();
+    }
+    return m_generation;
+}
+
+QImage Page::composite() const
 {
-    QPixmap result(m_width, m_height);
-    compositeToPixmap(result);
+    QImage result;
+    compositeToImage(result);
     return result;
 }
 
-void Page::compositeToPixmap(QPixmap &target) const
+void Page::compositeToImage(QImage &target) const
 {
-    target = QPixmap(m_width, m_height);
-    target.fill(getPaperColorValue(m_paperColor));
+    target = QImage(m_width, m_height, QImage::Format_ARGB32_Premultiplied);
+    const QColor paper = getPaperColorValue(m_paperColor);
 
-    QPainter painter(&target);
-    painter.setRenderHint(QPainter::Antialiasing, false);
+    forEachBand(target, target.rect(), [&](QImage &band, const QRect &bandRect, const QPoint &origin) {
+        band.fill(paper);
+        // Composite layers from bottom to top
+        for (const Layer &layer : m_layers) {
+            layer.blendTo(band, bandRect, origin);
+        }
+    });
+}
 
-    // Composite layers from bottom to top
-    for (const Layer &layer : m_layers) {
-        if (layer.isVisible()) {
-            layer.compositeTo(painter);
+void Page::compositeRect(QImage &target, const QRect &rect) const
+{
+    // Fall back to a full composite if the target does not match the page
+    if (target.size() != QSize(m_width, m_height)) {
+        compositeToImage(target);
+        return;
+    }
+
+    QRect dirty = rect.intersected(QRect(0, 0, m_width, m_height));
+    if (dirty.isEmpty()) {
+        return;
+    }
+
+    updateStacks();
+    const int current = qBound(0, m_currentLayerIndex, m_layers.size() - 1);
+
+    if (target.format() != QImage::Format_ARGB32_Premultiplied) {
+        target = target.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    }
+
+    forEachBand(target, dirty, [&](QImage &band, const QRect &bandRect, const QPoint &origin) {
+        // Reset the damaged area to the flattened paper and lower layers
+        for (int y = bandRect.top(); y <= bandRect.bottom(); ++y) {
+            memcpy(reinterpret_cast<QRgb*>(band.scanLine(y - origin.y())) + bandRect.left() - origin.x(),
+                   reinterpret_cast<const QRgb*>(m_below.image.constScanLine(y)) + bandRect.left(),
+                   bandRect.width() * sizeof(QRgb));
+        }
+
+        if (!m_layers.isEmpty()) {
+            m_layers.at(current).blendTo(band, bandRect, origin);
         }
+
+        if (!m_above.image.isNull()) {
+            for (int y = bandRect.top(); y <= bandRect.bottom(); ++y) {
+                blendRow(Layer::Normal, reinterpret_cast<const QRgb*>(m_above.image.constScanLine(y)) + bandRect.left(),
+                         reinterpret_cast<QRgb*>(band.scanLine(y - origin.y())) + bandRect.left() - origin.x(),
+                         bandRect.width());
+            }
+        } else {
+            for (int i = current + 1; i < m_layers.size(); ++i) {
+                m_layers.at(i).blendTo(band, bandRect, origin);
+            }
+        }
+    });
+}
+
+void Page::forEachBand(QImage &target, const QRect &rect,
+                       const std::function<void(QImage &band, const QRect &bandRect, const QPoint &origin)> &fn)
+{
+    // Bands follow the layer tile rows, so each tile is read by one thread
+    const int firstRow = rect.top() / LAYER_TILE_SIZE;
+    const int lastRow = rect.bottom() / LAYER_TILE_SIZE;
+    if (firstRow == lastRow) {
+        fn(target, rect, QPoint(0, 0));
+        return;
+    }
+
+    // Views share target's pixels; bits() is taken once here because it
+    // may detach, which must not happen from the worker threads
+    uchar *bits = target.bits();
+    const qsizetype bytesPerLine = target.bytesPerLine();
+    parallelFor(lastRow - firstRow + 1, [&](int index) {
+        const int top = (firstRow + index) * LAYER_TILE_SIZE;
+        const int height = qMin(LAYER_TILE_SIZE, target.height() - top);
+        QImage band(bits + top * bytesPerLine, target.width(), height, bytesPerLine, target.format());
+        fn(band, rect.intersected(QRect(0, top, target.width(), height)), QPoint(0, top));
+    });
+}
+
+QVector<quint64> Page::stackKey(int first, int last) const
+{
+    // Hidden layers add nothing, the generation stands in for the pixels
+    QVector<quint64> key;
+    for (int i = first; i < last; ++i) {
+        const Layer &layer = m_layers.at(i);
+        if (layer.isVisible() && layer.opacity() > 0.0) {
+            key << layer.generation()
+                << quint64(qRound64(layer.opacity() * 1000000.0))
+                << quint64(layer.blendMode());
+        }
+    }
+    return key;
+}
+
+bool Page::isFlattenable(int first, int last) const
+{
+    // Source-over is associative, the other blend modes need the real
+    // backdrop and are blended layer by layer instead
+    for (int i = first; i < last; ++i) {
+        const Layer &layer = m_layers.at(i);
+        if (layer.isVisible() && layer.opacity() > 0.0 && layer.blendMode() != Layer::Normal) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Page::updateStacks() const
+{
+    const int current = qBound(0, m_currentLayerIndex, m_layers.size() - 1);
+    const QSize size(m_width, m_height);
+
+    // The paper and layer count are part of the key so adding, removing
+    // or moving layers and changing the paper all rebuild the stacks
+    QVector<quint64> belowKey = stackKey(0, current);
+    belowKey << quint64(getPaperColorValue(m_paperColor).rgba()) << quint64(current) << quint64(m_layers.size());
+    if (m_below.image.size() != size || m_below.key != belowKey) {
+        m_below.image = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        const QColor paper = getPaperColorValue(m_paperColor);
+        forEachBand(m_below.image, m_below.image.rect(), [&](QImage &band, const QRect &bandRect, const QPoint &origin) {
+            band.fill(paper);
+            for (int i = 0; i < current; ++i) {
+                m_layers.at(i).blendTo(band, bandRect, origin);
+            }
+        });
+        m_below.key = belowKey;
+    }
+
+    // Nothing visible above, or nothing that can be flattened
+    QVector<quint64> aboveKey = stackKey(current + 1, m_layers.size());
+    if (aboveKey.isEmpty() || !isFlattenable(current + 1, m_layers.size())) {
+        m_above = FlattenedStack();
+        return;
+    }
+    aboveKey << quint64(current) << quint64(m_layers.size());
+    if (m_above.image.size() != size || m_above.key != aboveKey) {
+        m_above.image = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        forEachBand(m_above.image, m_above.image.rect(), [&](QImage &band, const QRect &bandRect, const QPoint &origin) {
+            band.fill(Qt::transparent);
+            for (int i = current + 1; i < m_layers.size(); ++i) {
+                m_layers.at(i).blendTo(band, bandRect, origin);
+            }
+        });
+        m_above.key = aboveKey;
+    }
+}
+
+bool Page::load()
+{
+    if (m_source.isNull()) {
+        return true;
+    }
+
+    QSharedPointer<PageSource> source = m_source;
+    m_source.reset();
+    if (!source->load()) {
+        return false;
+    }
+
+    // Paper color and size may have changed since the page was opened
+    // The generation the content was decoded with carries over, so caches
+    // filled by the loader still match unless the paper or size changed
+    m_layers = source->page().layers();
+    m_currentLayerIndex = source->page().currentLayerIndex();
+    m_generationKey = source->page().m_generationKey;
+    m_generation = source->page().m_generation;
+    for (Layer &layer : m_layers) {
+        layer.resize(m_width, m_height);
     }
+    return true;
 }
 
 void Page::clear()
 {
+    m_source.reset();
     m_layers.clear();
     addLayer("Layer 1");
 }
@@ -2,12 +2,17 @@
 
 #include "Layer.h"
 #include "Types.h"
-#include <QPixmap>
+#include <QImage>
 #include <QList>
+#include <QSharedPointer>
 #include <QString>
+#include <QVector>
+#include <functional>
 
 namespace Unimalen {
 
+class PageSource;
+
 constexpr int MAX_LAYERS_PER_PAGE = 3;
 
 class Page
@@ -23,6 +28,16 @@ public:
     int currentLayerIndex() const { return m_currentLayerIndex; }
     void setCurrentLayerIndex(int index);
 
+    // Drop the editing surfaces of all layers, keeping only their tiles,
+    // and the flattened stacks around the current layer
+    void releaseSurfaces();
+    // Fold pending surface edits into the tiles of all layers
+    void flush() const;
+    // Give this copy of a page Layer objects of its own. Copies of a page
+    // otherwise share them, so a copy handed to another thread would flush
+    // the same layers the GUI thread is painting on.
+    void detachLayers();
+
     Layer& currentLayer();
     const Layer& currentLayer() const;
 
@@ -35,9 +50,26 @@ public:
     void setLayerBlendMode(int index, Layer::BlendMode mode);
     void setLayerName(int index, const QString &name);
 
+    // Changes whenever anything the flattened page depends on changes:
+    // layer pixels, order, visibility, opacity and blend mode, the paper
+    // and the size. Values are unique across pages, so equal generations
+    // always mean equal composites.
+    quint64 generation() const;
+
     // Compositing
-    QPixmap composite() const;
-    void compositeToPixmap(QPixmap &target) const;
+    QImage composite() const;
+    void compositeToImage(QImage &target) const;
+    // Re-blend only the damaged rectangle of an existing page-sized target.
+    // The layers below and above the current one are blended from cached
+    // flattened copies, so this touches at most three surfaces.
+    void compositeRect(QImage &target, const QRect &rect) const;
+
+    // Pages opened lazily hold a pending source until load() resolves it.
+    // Until then the page only has a blank placeholder layer.
+    bool isLoaded() const { return m_source.isNull(); }
+    void setSource(const QSharedPointer<PageSource> &source) { m_source = source; }
+    const PageSource* source() const { return m_source.data(); }
+    bool load();
 
     // Page state
     void clear();
@@ -51,11 +83,32 @@ public:
     void setPaperColor(PaperColor color) { m_paperColor = color; }
 
 private:
+    // A flattened run of layers and the state it was built from
+    struct FlattenedStack {
+        QImage image;
+        QVector<quint64> key;
+    };
+
+    // Run fn on the horizontal bands of rect in parallel. Each call gets a
+    // view of target holding just its band, whose top left pixel is the
+    // page pixel at origin, and the part of rect inside it.
+    static void forEachBand(QImage &target, const QRect &rect,
+                            const std::function<void(QImage &band, const QRect &bandRect, const QPoint &origin)> &fn);
+
+    QVector<quint64> stackKey(int first, int last) const;
+    bool isFlattenable(int first, int last) const;
+    void updateStacks() const;
+
     int m_width;
     int m_height;
     PaperColor m_paperColor;
     QList<Layer> m_layers;
     int m_currentLayerIndex;
+    QSharedPointer<PageSource> m_source;
+    mutable FlattenedStack m_below; // Paper and every layer under the current one
+    mutable FlattenedStack m_above; // Every layer over it, on transparent
+    mutable QVector<quint64> m_generationKey;
+    mutable quint64 m_generation;
 };
 
 } // namespace Unimalen
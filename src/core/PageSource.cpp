@@ -0,0 +1,34 @@
+#include "PageSource.h"
+#include <QThreadPool>
+
+namespace Unimalen {
+
+PageSource::PageSource(int width, int height, const Loader &loader)
+    : m_loader(loader)
+    , m_finished(false)
+    , m_succeeded(false)
+    , m_page(width, height)
+    , m_owner(nullptr)
+    , m_originIndex(-1)
+{
+}
+
+bool PageSource::load()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_finished) {
+        m_succeeded = m_loader(m_page);
+        m_finished = true;
+        m_loader = nullptr;
+    }
+    return m_succeeded;
+}
+
+void PageSource::prefetch()
+{
+    // The task keeps the source alive even if its page is dropped meanwhile
+    QSharedPointer<PageSource> self = sharedFromThis();
+    QThreadPool::globalInstance()->start([self]() { self->load(); });
+}
+
+} // namespace Unimalen
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Page.h"
+#include <QEnableSharedFromThis>
+#include <QMutex>
+#include <functional>
+
+namespace Unimalen {
+
+// Deferred page content, such as a page file that has not been decoded yet.
+// The loader runs at most once, either on first access or ahead of time on
+// the global thread pool; an access during a prefetch waits for it.
+class PageSource : public QEnableSharedFromThis<PageSource>
+{
+public:
+    using Loader = std::function<bool(Page &page)>;
+
+    PageSource(int width, int height, const Loader &loader);
+
+    // Runs the loader unless it already ran, returns whether it succeeded
+    bool load();
+    // Queue load() on the global thread pool
+    void prefetch();
+
+    // Decoded content, valid once load() returned true
+    const Page& page() const { return m_page; }
+
+    // Where the content comes from, such as a page of an open file, so that
+    // file can write it back without decoding. owner is only compared.
+    void setOrigin(const void *owner, int index) { m_owner = owner; m_originIndex = index; }
+    const void* owner() const { return m_owner; }
+    int originIndex() const { return m_originIndex; }
+
+private:
+    QMutex m_mutex;
+    Loader m_loader;
+    bool m_finished;
+    bool m_succeeded;
+    Page m_page;
+    const void *m_owner;
+    int m_originIndex;
+};
+
+} // namespace Unimalen
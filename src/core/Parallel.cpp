@@ -0,0 +1,36 @@
+#include "Parallel.h"
+#include <QSemaphore>
+#include <QThreadPool>
+#include <atomic>
+
+namespace Unimalen {
+
+void parallelFor(int count, const std::function<void(int)> &fn)
+{
+    if (count <= 0) {
+        return;
+    }
+
+    std::atomic<int> next{0};
+    auto work = [&]() {
+        for (int i = next++; i < count; i = next++) {
+            fn(i);
+        }
+    };
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    QSemaphore finished;
+    int helpers = qMin(count - 1, pool->maxThreadCount());
+    int started = 0;
+    for (int i = 0; i < helpers; ++i) {
+        if (!pool->tryStart([&]() { work(); finished.release(); })) {
+            break;
+        }
+        ++started;
+    }
+
+    work();
+    finished.acquire(started);
+}
+
+} // namespace Unimalen
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <functional>
+
+namespace Unimalen {
+
+// Run fn(0) .. fn(count - 1) on the global thread pool and wait for all of
+// them. The calling thread takes part, so this never deadlocks when the pool
+// is busy; indices are handed out one at a time in increasing order.
+void parallelFor(int count, const std::function<void(int)> &fn);
+
+} // namespace Unimalen
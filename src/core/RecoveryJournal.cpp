@@ -0,0 +1,398 @@
+#include "RecoveryJournal.h"
+#include "Document.h"
+#include "TileIO.h"
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <algorithm>
+
+namespace Unimalen {
+
+static const quint32 CHECKPOINT_MAGIC = 0x47524350; // "GRCP"
+static const quint32 JOURNAL_MAGIC = 0x47524a4c;    // "GRJL"
+static const quint32 RECOVERY_VERSION = 1;
+
+QString RecoveryJournal::checkpointPath(const QString &basePath, int segment)
+{
+    return QString("%1.%2.checkpoint").arg(basePath).arg(segment);
+}
+
+QString RecoveryJournal::journalPath(const QString &basePath, int segment)
+{
+    return QString("%1.%2.journal").arg(basePath).arg(segment);
+}
+
+QString RecoveryJournal::lockPath(const QString &basePath)
+{
+    return basePath + ".lock";
+}
+
+QVector<int> RecoveryJournal::segments(const QString &basePath, const QString &suffix)
+{
+    QFileInfo base(basePath);
+    QStringList files = base.dir().entryList(QStringList() << base.fileName() + ".*." + suffix, QDir::Files);
+
+    QVector<int> result;
+    for (const QString &file : files) {
+        bool ok = false;
+        int segment = file.section('.', -2, -2).toInt(&ok);
+        if (ok) {
+            result.append(segment);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+QByteArray RecoveryJournal::structure(const Document &document)
+{
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << qint32(document.width()) << qint32(document.height())
+           << qint32(document.paperColor()) << qint32(document.pages().size());
+    for (const Page &page : document.pages()) {
+        stream << qint32(page.layers().size());
+        for (const Layer &layer : page.layers()) {
+            stream << layer.id() << layer.name() << layer.isVisible()
+                   << layer.opacity() << qint32(layer.blendMode());
+        }
+    }
+    return key;
+}
+
+void RecoveryJournal::setBasePath(const QString &basePath)
+{
+    if (basePath != m_basePath) {
+        discard();
+        m_lock.reset();
+        m_basePath = basePath;
+
+        // Keeps other instances from taking these files for a crash. A lock
+        // left by a process that is gone is stale and taken over.
+        if (!m_basePath.isEmpty()) {
+            QDir().mkpath(QFileInfo(m_basePath).absolutePath());
+            m_lock.reset(new QLockFile(lockPath(m_basePath)));
+            m_lock->setStaleLockTime(0);
+            m_lock->tryLock(0);
+        }
+    }
+}
+
+int RecoveryJournal::startSegment(const Document &document)
+{
+    if (m_basePath.isEmpty()) {
+        return -1;
+    }
+
+    QVector<int> existing = segments(m_basePath, "journal") + segments(m_basePath, "checkpoint");
+    std::sort(existing.begin(), existing.end());
+    int segment = qMax(m_segment, existing.isEmpty() ? -1 : existing.last()) + 1;
+
+    m_file.close();
+    m_file.setFileName(journalPath(m_basePath, segment));
+    QDir().mkpath(QFileInfo(m_basePath).absolutePath());
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return -1;
+    }
+
+    QDataStream stream(&m_file);
+    stream << JOURNAL_MAGIC << RECOVERY_VERSION;
+    m_file.flush();
+
+    m_segment = segment;
+    m_structure = structure(document);
+    m_generations.clear();
+    for (const Page &page : document.pages()) {
+        for (const Layer &layer : page.layers()) {
+            m_generations.insert(layer.id(), layer.generation());
+        }
+    }
+    return segment;
+}
+
+bool RecoveryJournal::writeCheckpoint(const QString &basePath, int segment, Document snapshot)
+{
+    if (segment < 0) {
+        return false;
+    }
+
+    QString path = checkpointPath(basePath, segment);
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream << CHECKPOINT_MAGIC << RECOVERY_VERSION
+           << qint32(snapshot.width()) << qint32(snapshot.height())
+           << qint32(snapshot.paperColor())
+           << qint32(snapshot.pageCount()) << qint32(snapshot.currentPageIndex());
+
+    for (int i = 0; i < snapshot.pageCount(); ++i) {
+        const Page &page = snapshot.pageAt(i);
+        stream << qint32(page.layers().size()) << qint32(page.currentLayerIndex());
+        for (const Layer &layer : page.layers()) {
+            stream << layer.id() << layer.name() << layer.isVisible()
+                   << layer.opacity() << qint32(layer.blendMode());
+
+            QByteArray raw;
+            QDataStream tileStream(&raw, QIODevice::WriteOnly);
+            tileStream << qint32(layer.tileCount());
+            for (int t = 0; t < layer.tileCount(); ++t) {
+                writeTile(tileStream, layer.tileAt(t));
+            }
+            stream << qCompress(raw, 1);
+        }
+    }
+
+    if (!file.commit()) {
+        return false;
+    }
+
+    // The journal was discarded while this was being written
+    if (!QFile::exists(journalPath(basePath, segment))) {
+        QFile::remove(path);
+        return false;
+    }
+
+    // Older segments are covered by this checkpoint now
+    for (int old : segments(basePath, "journal")) {
+        if (old < segment) {
+            QFile::remove(journalPath(basePath, old));
+        }
+    }
+    for (int old : segments(basePath, "checkpoint")) {
+        if (old < segment) {
+            QFile::remove(checkpointPath(basePath, old));
+        }
+    }
+    return true;
+}
+
+bool RecoveryJournal::appendTiles(const Layer &layer, const QVector<int> &tiles)
+{
+    if (!m_file.isOpen() || tiles.isEmpty()) {
+        return false;
+    }
+
+    QByteArray raw;
+    QDataStream tileStream(&raw, QIODevice::WriteOnly);
+    for (int index : tiles) {
+        tileStream << qint32(index);
+        writeTile(tileStream, layer.tileAt(index));
+    }
+
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream << layer.id() << qint32(tiles.size()) << qCompress(raw, 1);
+
+    // One write per record, a crash can only tear the last one
+    if (m_file.write(record) != record.size() || !m_file.flush()) {
+        return false;
+    }
+    m_generations.insert(layer.id(), layer.generation());
+    return true;
+}
+
+bool RecoveryJournal::hasStructure(const Document &document) const
+{
+    return m_file.isOpen() && structure(document) == m_structure;
+}
+
+bool RecoveryJournal::isInSync(const Document &document) const
+{
+    if (!hasStructure(document)) {
+        return false;
+    }
+    for (const Page &page : document.pages()) {
+        for (const Layer &layer : page.layers()) {
+            if (m_generations.value(layer.id()) != layer.generation()) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void RecoveryJournal::discard()
+{
+    m_file.close();
+    if (!m_basePath.isEmpty()) {
+        removeFiles(m_basePath);
+    }
+    // m_segment is kept, so numbers are never reused while a checkpoint
+    // of an earlier segment may still be in flight
+    m_structure.clear();
+    m_generations.clear();
+}
+
+void RecoveryJournal::removeFiles(const QString &basePath)
+{
+    // Journals go first so a checkpoint still being written sees it was
+    // discarded and removes itself
+    for (int segment : segments(basePath, "journal")) {
+        QFile::remove(journalPath(basePath, segment));
+    }
+    for (int segment : segments(basePath, "checkpoint")) {
+        QFile::remove(checkpointPath(basePath, segment));
+    }
+}
+
+QStringList RecoveryJournal::pendingRecoveries(const QString &directory)
+{
+    QDir dir(directory);
+    QSet<QString> bases;
+    for (const QString &file : dir.entryList(QStringList() << "*.checkpoint" << "*.journal", QDir::Files)) {
+        bases.insert(dir.filePath(file.section('.', 0, 0)));
+    }
+
+    // Journals of documents open in a running instance are live
+    QStringList result;
+    for (const QString &base : bases) {
+        QLockFile lock(lockPath(base));
+        lock.setStaleLockTime(0);
+        if (lock.tryLock(0)) {
+            result.append(base);
+        }
+    }
+    result.sort();
+    return result;
+}
+
+bool RecoveryJournal::replay(const QString &basePath, Document &document)
+{
+    QVector<int> checkpoints = segments(basePath, "checkpoint");
+    if (checkpoints.isEmpty()) {
+        return false;
+    }
+    const int first = checkpoints.last();
+
+    QFile file(checkpointPath(basePath, first));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint32 width = 0;
+    qint32 height = 0;
+    qint32 paperColor = 0;
+    qint32 pageCount = 0;
+    qint32 currentPage = 0;
+    stream >> magic >> version >> width >> height >> paperColor >> pageCount >> currentPage;
+    if (magic != CHECKPOINT_MAGIC || version != RECOVERY_VERSION || stream.status() != QDataStream::Ok
+        || width <= 0 || height <= 0 || pageCount <= 0 || pageCount > MAX_PAGES) {
+        return false;
+    }
+
+    document.clear();
+    document.resize(width, height);
+    document.setPaperColor(PaperColor(paperColor));
+    while (document.pageCount() < pageCount) {
+        document.addPage();
+    }
+
+    // Journals refer to layers by the ids they had when recorded
+    QHash<quint64, QPair<int, int>> layersById;
+    for (int i = 0; i < pageCount; ++i) {
+        qint32 layerCount = 0;
+        qint32 currentLayer = 0;
+        stream >> layerCount >> currentLayer;
+        if (stream.status() != QDataStream::Ok || layerCount <= 0 || layerCount > MAX_LAYERS_PER_PAGE) {
+            return false;
+        }
+
+        QList<Layer> layers;
+        for (int l = 0; l < layerCount; ++l) {
+            quint64 id = 0;
+            QString name;
+            bool visible = true;
+            qreal opacity = 1.0;
+            qint32 blendMode = 0;
+            QByteArray packed;
+            stream >> id >> name >> visible >> opacity >> blendMode >> packed;
+
+            Layer layer(name, width, height);
+            layer.setVisible(visible);
+            layer.setOpacity(opacity);
+            layer.setBlendMode(Layer::BlendMode(blendMode));
+
+            QByteArray raw = qUncompress(packed);
+            QDataStream tileStream(raw);
+            qint32 tileCount = 0;
+            tileStream >> tileCount;
+            if (tileCount != layer.tileCount()) {
+                return false;
+            }
+            for (int t = 0; t < tileCount; ++t) {
+                layer.setTile(t, readTile(tileStream));
+            }
+            if (tileStream.status() != QDataStream::Ok) {
+                return false;
+            }
+
+            layersById.insert(id, qMakePair(i, l));
+            layers.append(layer);
+        }
+
+        Page &page = document.pageAt(i);
+        page.layers() = layers;
+        page.setCurrentLayerIndex(currentLayer);
+    }
+    if (stream.status() != QDataStream::Ok) {
+        return false;
+    }
+    document.setCurrentPageIndex(currentPage);
+
+    // Apply the journals from the checkpoint on, in order. A torn record at
+    // the end of a journal ends that journal.
+    for (int segment : segments(basePath, "journal")) {
+        if (segment < first) {
+            continue;
+        }
+
+        QFile journal(journalPath(basePath, segment));
+        if (!journal.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        QDataStream journalStream(&journal);
+        journalStream >> magic >> version;
+        if (magic != JOURNAL_MAGIC || version != RECOVERY_VERSION) {
+            continue;
+        }
+
+        while (!journalStream.atEnd()) {
+            quint64 id = 0;
+            qint32 count = 0;
+            QByteArray packed;
+            journalStream >> id >> count >> packed;
+            if (journalStream.status() != QDataStream::Ok) {
+                break;
+            }
+
+            auto location = layersById.constFind(id);
+            if (location == layersById.constEnd()) {
+                continue;
+            }
+            Layer &layer = document.pageAt(location->first).layers()[location->second];
+
+            QByteArray raw = qUncompress(packed);
+            QDataStream tileStream(raw);
+            for (int t = 0; t < count; ++t) {
+                qint32 index = -1;
+                tileStream >> index;
+                QImage tile = readTile(tileStream);
+                if (tileStream.status() != QDataStream::Ok) {
+                    break;
+                }
+                layer.setTile(index, tile);
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace Unimalen
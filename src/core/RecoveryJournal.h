@@ -0,0 +1,80 @@
+#pragma once
+
+#include <QFile>
+#include <QHash>
+#include <QLockFile>
+#include <QScopedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+namespace Unimalen {
+
+class Document;
+class Layer;
+
+// A segment is compacted into a new checkpoint once its deltas grow past this
+constexpr qint64 RECOVERY_COMPACT_BYTES = 32 * 1024 * 1024;
+
+// Crash recovery for one document. The state is a checkpoint of the whole
+// document followed by journal segments of changed tiles, appended as edits
+// happen:
+//
+//   <base>.<n>.checkpoint   document at the start of segment n
+//   <base>.<n>.journal      tile deltas made since then
+//   <base>.lock             held while the document is open
+//
+// Starting segment n + 1 only needs a snapshot of the document, the
+// checkpoint itself can be written on another thread. Until it lands, the
+// previous checkpoint plus both journals still describe the document.
+// The files are removed on a clean close, so any left over without a live
+// lock mean the instance that wrote them did not exit cleanly.
+class RecoveryJournal
+{
+public:
+    RecoveryJournal() = default;
+
+    void setBasePath(const QString &basePath);
+    QString basePath() const { return m_basePath; }
+    bool isActive() const { return m_file.isOpen(); }
+
+    // Start a new segment. The caller writes the matching checkpoint from a
+    // snapshot of the document taken at the same time.
+    int startSegment(const Document &document);
+    static bool writeCheckpoint(const QString &basePath, int segment, Document snapshot);
+
+    // Append the given tiles of a layer as they are now
+    bool appendTiles(const Layer &layer, const QVector<int> &tiles);
+
+    // Whether every change of the document has been recorded, i.e. it has
+    // the layer structure of the last checkpoint and no unjournaled edits
+    bool isInSync(const Document &document) const;
+    bool hasStructure(const Document &document) const;
+    qint64 segmentBytes() const { return m_file.isOpen() ? m_file.size() : 0; }
+
+    // Stop journaling and delete all recovery files
+    void discard();
+
+    // Base paths in directory with recovery files left behind, skipping
+    // those still locked by a running instance. replay() fails for those
+    // that never got a checkpoint written.
+    static QStringList pendingRecoveries(const QString &directory);
+    static bool replay(const QString &basePath, Document &document);
+    static void removeFiles(const QString &basePath);
+
+private:
+    static QString checkpointPath(const QString &basePath, int segment);
+    static QString journalPath(const QString &basePath, int segment);
+    static QString lockPath(const QString &basePath);
+    static QVector<int> segments(const QString &basePath, const QString &suffix);
+    static QByteArray structure(const Document &document);
+
+    QString m_basePath;
+    QScopedPointer<QLockFile> m_lock;
+    QFile m_file;
+    int m_segment = -1;
+    QByteArray m_structure;
+    QHash<quint64, quint64> m_generations; // Layer id to last recorded generation
+};
+
+} // namespace Unimalen
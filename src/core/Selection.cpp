@@ -0,0 +1,120 @@
+#include "Selection.h"
+#include <QPainter>
+#include <cstring>
+
+namespace Unimalen {
+
+Selection Selection::fromCoverage(const QImage &coverage, const QPoint &origin)
+{
+    Selection selection;
+    selection.m_coverage = coverage;
+    selection.m_origin = origin;
+    selection.m_spans = SpanMask(coverage.width(), coverage.height());
+    for (int y = 0; y < coverage.height(); ++y) {
+        const uchar *line = coverage.constScanLine(y);
+        int x = 0;
+        while (x < coverage.width()) {
+            if (!line[x]) {
+                ++x;
+                continue;
+            }
+            const int start = x;
+            while (x < coverage.width() && line[x]) {
+                ++x;
+            }
+            selection.m_spans.addSpan(y, start, x - start);
+        }
+    }
+    return selection;
+}
+
+Selection Selection::fromRect(const QRect &rect, const QRect &bounds)
+{
+    const QRect clipped = rect.normalized() & bounds;
+    if (clipped.isEmpty()) {
+        return Selection();
+    }
+
+    QImage coverage(clipped.size(), QImage::Format_Alpha8);
+    coverage.fill(255);
+    return fromCoverage(coverage, clipped.topLeft());
+}
+
+Selection Selection::fromPolygon(const QPolygon &polygon, const QRect &bounds)
+{
+    const QRect clipped = polygon.boundingRect() & bounds;
+    if (polygon.size() < 3 || clipped.isEmpty()) {
+        return Selection();
+    }
+
+    QImage coverage(clipped.size(), QImage::Format_Alpha8);
+    coverage.fill(0);
+    QPainter painter(&coverage);
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(Qt::white);
+    painter.drawPolygon(polygon.translated(-clipped.topLeft()), Qt::OddEvenFill);
+    painter.end();
+    return fromCoverage(coverage, clipped.topLeft());
+}
+
+Selection Selection::fromSpans(const SpanMask &mask)
+{
+    const QRect bounds = mask.boundingRect();
+    if (bounds.isEmpty()) {
+        return Selection();
+    }
+
+    QImage coverage(bounds.size(), QImage::Format_Alpha8);
+    coverage.fill(0);
+    for (int y = bounds.top(); y <= bounds.bottom(); ++y) {
+        uchar *line = coverage.scanLine(y - bounds.top());
+        for (const Span &span : mask.spans(y)) {
+            memset(line + span.x - bounds.left(), 255, span.length);
+        }
+    }
+    return fromCoverage(coverage, bounds.topLeft());
+}
+
+bool Selection::contains(const QPoint &point) const
+{
+    const QPoint local = point - m_origin;
+    return m_spans.contains(local.x(), local.y());
+}
+
+QImage Selection::copy(const QImage &image) const
+{
+    if (isEmpty()) {
+        return QImage();
+    }
+
+    // Outside the image reads as transparent
+    QImage result = image.convertToFormat(QImage::Format_ARGB32_Premultiplied).copy(boundingRect());
+    QPainter painter(&result);
+    painter.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+    painter.drawImage(0, 0, m_coverage);
+    return result;
+}
+
+void Selection::clear(QImage &image) const
+{
+    fill(image, Qt::transparent);
+}
+
+void Selection::fill(QImage &image, const QColor &color) const
+{
+    if (isEmpty()) {
+        return;
+    }
+
+    // Spans are filled as whole rows, no clip region has to be built
+    QPainter painter(&image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    const QRect bounds = boundingRect();
+    for (int y = 0; y < bounds.height(); ++y) {
+        for (const Span &span : m_spans.spans(y)) {
+            painter.fillRect(QRect(bounds.left() + span.x, bounds.top() + y, span.length, 1), color);
+        }
+    }
+}
+
+} // namespace Unimalen
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "SpanMask.h"
+#include <QColor>
+#include <QImage>
+#include <QPolygon>
+#include <QRect>
+
+namespace Unimalen {
+
+// A selected area of a page. It is rasterized once, when the selection is
+// completed, into an 8-bit coverage mask over its bounding rect and the
+// same area as spans; moving it afterwards only moves its origin.
+class Selection
+{
+public:
+    Selection() = default;
+
+    // Clipped to bounds, the page rect. Polygons use the odd-even rule.
+    static Selection fromRect(const QRect &rect, const QRect &bounds);
+    static Selection fromPolygon(const QPolygon &polygon, const QRect &bounds);
+    static Selection fromSpans(const SpanMask &mask);
+
+    bool isEmpty() const { return m_spans.isEmpty(); }
+    QRect boundingRect() const { return QRect(m_origin, m_coverage.size()); }
+    void translate(const QPoint &offset) { m_origin += offset; }
+    bool contains(const QPoint &point) const;
+
+    // Alpha8 coverage and spans, both relative to boundingRect().topLeft()
+    const QImage& coverage() const { return m_coverage; }
+    const SpanMask& spans() const { return m_spans; }
+
+    // The selected pixels of image, cropped to boundingRect()
+    QImage copy(const QImage &image) const;
+    // Make the selected pixels of image transparent, or set them to color
+    void clear(QImage &image) const;
+    void fill(QImage &image, const QColor &color) const;
+
+private:
+    static Selection fromCoverage(const QImage &coverage, const QPoint &origin);
+
+    QImage m_coverage;
+    SpanMask m_spans;
+    QPoint m_origin;
+};
+
+} // namespace Unimalen
@@ -0,0 +1,66 @@
+#include "SpanMask.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Unimalen {
+
+SpanMask::SpanMask(int width, int height)
+    : m_width(width)
+    , m_height(height)
+    , m_rows(height)
+{
+}
+
+void SpanMask::addSpan(int y, int x, int length)
+{
+    if (y < 0 || y >= m_height || length <= 0) {
+        return;
+    }
+
+    QVector<Span> &row = m_rows[y];
+    auto position = std::lower_bound(row.begin(), row.end(), x,
+                                     [](const Span &span, int value) { return span.x < value; });
+    row.insert(position, Span{x, length});
+
+    m_area += length;
+    m_bounds |= QRect(x, y, length, 1);
+}
+
+bool SpanMask::contains(int x, int y) const
+{
+    if (y < 0 || y >= m_height) {
+        return false;
+    }
+
+    // Last span starting at or before x
+    const QVector<Span> &row = m_rows[y];
+    auto after = std::upper_bound(row.begin(), row.end(), x,
+                                  [](int value, const Span &span) { return value < span.x; });
+    return after != row.begin() && x < (after - 1)->end();
+}
+
+QImage cropToMask(const QImage &image, const SpanMask &mask)
+{
+    const QRect bounds = mask.boundingRect() & image.rect();
+    if (bounds.isEmpty()) {
+        return QImage();
+    }
+
+    QImage source = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage result(bounds.size(), QImage::Format_ARGB32_Premultiplied);
+    result.fill(Qt::transparent);
+    for (int y = bounds.top(); y <= bounds.bottom(); ++y) {
+        const QRgb *src = reinterpret_cast<const QRgb*>(source.constScanLine(y));
+        QRgb *dst = reinterpret_cast<QRgb*>(result.scanLine(y - bounds.top()));
+        for (const Span &span : mask.spans(y)) {
+            const int start = qMax(span.x, bounds.left());
+            const int end = qMin(span.end(), bounds.right() + 1);
+            if (end > start) {
+                memcpy(dst + start - bounds.left(), src + start, (end - start) * sizeof(QRgb));
+            }
+        }
+    }
+    return result;
+}
+
+} // namespace Unimalen
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+namespace Unimalen {
+
+// Horizontal run of pixels [x, x + length) on one row
+struct Span
+{
+    int x;
+    int length;
+
+    int end() const { return x + length; }
+};
+
+// Run-length pixel mask. Each row holds sorted, non-overlapping spans, so
+// a filled page costs a few bytes per row instead of a pixel mask.
+class SpanMask
+{
+public:
+    SpanMask() = default;
+    SpanMask(int width, int height);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    bool isEmpty() const { return m_area == 0; }
+    qint64 area() const { return m_area; }
+    QRect boundingRect() const { return m_bounds; }
+
+    // Spans must not overlap ones already on the row
+    void addSpan(int y, int x, int length);
+    const QVector<Span>& spans(int y) const { return m_rows[y]; }
+    bool contains(int x, int y) const;
+
+private:
+    int m_width = 0;
+    int m_height = 0;
+    qint64 m_area = 0;
+    QRect m_bounds;
+    QVector<QVector<Span>> m_rows;
+};
+
+// The pixels of image under mask, cropped to the mask's bounding rect and
+// transparent elsewhere. Null for an empty mask.
+QImage cropToMask(const QImage &image, const SpanMask &mask);
+
+} // namespace Unimalen
@@ -0,0 +1,47 @@
+#include "TileIO.h"
+#include "Layer.h"
+
+namespace Unimalen {
+
+void writeTile(QDataStream &stream, const QImage &tile)
+{
+    stream << tile.isNull();
+    if (tile.isNull()) {
+        return;
+    }
+
+    stream << qint32(tile.width()) << qint32(tile.height());
+    const int rowBytes = tile.width() * 4;
+    for (int y = 0; y < tile.height(); ++y) {
+        stream.writeRawData(reinterpret_cast<const char*>(tile.constScanLine(y)), rowBytes);
+    }
+}
+
+QImage readTile(QDataStream &stream)
+{
+    bool isNull = true;
+    stream >> isNull;
+    if (isNull || stream.status() != QDataStream::Ok) {
+        return QImage();
+    }
+
+    qint32 width = 0;
+    qint32 height = 0;
+    stream >> width >> height;
+    if (width <= 0 || height <= 0 || width > LAYER_TILE_SIZE || height > LAYER_TILE_SIZE) {
+        stream.setStatus(QDataStream::ReadCorruptData);
+        return QImage();
+    }
+
+    QImage tile(width, height, QImage::Format_ARGB32_Premultiplied);
+    const int rowBytes = width * 4;
+    for (int y = 0; y < height; ++y) {
+        if (stream.readRawData(reinterpret_cast<char*>(tile.scanLine(y)), rowBytes) != rowBytes) {
+            stream.setStatus(QDataStream::ReadPastEnd);
+            return QImage();
+        }
+    }
+    return tile;
+}
+
+} // namespace Unimalen
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <QDataStream>
+#include <QImage>
+
+namespace Unimalen {
+
+// Raw tile serialization shared by undo storage, recovery journals and the
+// native file format. Null tiles (fully transparent) take a single flag.
+void writeTile(QDataStream &stream, const QImage &tile);
+// Returns a null image for null tiles and for malformed data
+QImage readTile(QDataStream &stream);
+
+} // namespace Unimalen
@@ -10,6 +10,8 @@ namespace Unimalen {
 constexpr int DEFAULT_CANVAS_WIDTH = 576;
 constexpr int DEFAULT_CANVAS_HEIGHT = 720;
 constexpr int DEFAULT_DPI = 72;
+constexpr int DEFAULT_UNDO_BUDGET_MB = 256; // Per canvas undo history
+constexpr int DEFAULT_COMPOSITE_CACHE_MB = DEFAULT_UNDO_BUDGET_MB / 4; // Flattened pages per document
 
 // Paper color enumeration
 enum class PaperColor {
@@ -1,14 +1,19 @@
 #include "UndoCommands.h"
 #include "Layer.h"
+#include "Document.h"
+#include "UndoJournal.h"
+#include "TileIO.h"
 #include <QPainter>
+#include <QDataStream>
+#include <QDebug>
 
 namespace Unimalen {
 
-PaintCommand::PaintCommand(Layer *layer, const QPixmap &oldPixmap, const QPixmap &newPixmap,
+PaintCommand::PaintCommand(Layer *layer, const QImage &oldImage, const QImage &newImage,
                            const QString &text)
     : m_layer(layer)
-    , m_oldPixmap(oldPixmap)
-    , m_newPixmap(newPixmap)
+    , m_oldImage(oldImage)
+    , m_newImage(newImage)
 {
     setText(text);
 }
@@ -16,14 +21,262 @@ PaintCommand::PaintCommand(Layer *layer, const QPixmap &oldPixmap, const QPixmap
 void PaintCommand::undo()
 {
     if (m_layer) {
-        m_layer->pixmap() = m_oldPixmap;
+        m_layer->setImage(m_oldImage);
     }
 }
 
 void PaintCommand::redo()
 {
     if (m_layer) {
-        m_layer->pixmap() = m_newPixmap;
+        m_layer->setImage(m_newImage);
+    }
+}
+
+LayerTilesCommand::LayerTilesCommand(Document *document, quint64 layerId,
+                                     const QVector<QImage> &before, const QString &text)
+    : m_document(document)
+    , m_layerId(layerId)
+    , m_tileCount(before.size())
+    , m_firstRedo(true)
+    , m_storage(InMemory)
+    , m_journal(nullptr)
+    , m_journalOffset(0)
+    , m_journalSize(0)
+{
+    setText(text);
+
+    Layer *layer = m_document ? m_document->findLayer(m_layerId) : nullptr;
+    if (!layer || layer->tileCount() != m_tileCount) {
+        return;
+    }
+
+    // Unchanged tiles keep their data across a flush, so a different cache
+    // key means the tile was touched
+    QVector<QImage> after = layer->tiles();
+    for (int i = 0; i < m_tileCount; ++i) {
+        if (before[i].cacheKey() != after[i].cacheKey()) {
+            m_changes.append({i, before[i], after[i]});
+        }
+    }
+}
+
+void LayerTilesCommand::undo()
+{
+    apply(false);
+}
+
+void LayerTilesCommand::redo()
+{
+    // The edit is already on the layer when the command is pushed
+    if (m_firstRedo) {
+        m_firstRedo = false;
+        return;
+    }
+    apply(true);
+}
+
+void LayerTilesCommand::apply(bool after)
+{
+    int pageIndex = 0;
+    Layer *layer = m_document ? m_document->findLayer(m_layerId, &pageIndex) : nullptr;
+    if (!layer || layer->tileCount() != m_tileCount) {
+        return;
+    }
+
+    // A step that cannot be read back is left alone rather than applied
+    // with blank tiles
+    if (!restore()) {
+        qWarning() << "Failed to restore undo data for" << text();
+        return;
+    }
+
+    // Bring the edited page back into view
+    m_document->setCurrentPageIndex(pageIndex);
+
+    for (const TileChange &change : m_changes) {
+        layer->setTile(change.index, after ? change.after : change.before);
+    }
+}
+
+QVector<int> LayerTilesCommand::changedTiles() const
+{
+    QVector<int> indices;
+    indices.reserve(m_changes.size());
+    for (const TileChange &change : m_changes) {
+        indices.append(change.index);
+    }
+    return indices;
+}
+
+qint64 LayerTilesCommand::byteSize() const
+{
+    QSet<qint64> counted;
+    return byteSize(counted);
+}
+
+static qint64 uncountedBytes(const QImage &tile, QSet<qint64> &counted)
+{
+    if (tile.isNull() || counted.contains(tile.cacheKey())) {
+        return 0;
+    }
+    counted.insert(tile.cacheKey());
+    return tile.sizeInBytes();
+}
+
+qint64 LayerTilesCommand::byteSize(QSet<qint64> &counted) const
+{
+    switch (m_storage) {
+        case InMemory: {
+            qint64 bytes = 0;
+            for (const TileChange &change : m_changes) {
+                bytes += uncountedBytes(change.before, counted) + uncountedBytes(change.after, counted);
+            }
+            return bytes;
+        }
+        case Compressed:
+            return m_packed.size();
+        case Spilled:
+            return 0;
+    }
+    return 0;
+}
+
+void LayerTilesCommand::compress() const
+{
+    if (m_storage != InMemory || m_changes.isEmpty()) {
+        return;
+    }
+
+    // Tiles are stored raw, zlib does well on the flat areas of line art
+    QByteArray raw;
+    QDataStream stream(&raw, QIODevice::WriteOnly);
+    for (TileChange &change : m_changes) {
+        writeTile(stream, change.before);
+        writeTile(stream, change.after);
+        change.before = QImage();
+        change.after = QImage();
+    }
+
+    m_packed = qCompress(raw, 1);
+    m_storage = Compressed;
+}
+
+void LayerTilesCommand::spill(UndoJournal *journal) const
+{
+    compress();
+    if (m_storage != Compressed || !journal) {
+        return;
+    }
+
+    qint64 offset = journal->append(m_packed);
+    if (offset < 0) {
+        // Keep the data in memory if the journal cannot be written
+        return;
+    }
+
+    m_journal = journal;
+    m_journalOffset = offset;
+    m_journalSize = m_packed.size();
+    m_packed.clear();
+    m_storage = Spilled;
+}
+
+bool LayerTilesCommand::restore() const
+{
+    if (m_storage == InMemory) {
+        return true;
+    }
+
+    // Nothing is changed until everything has been read back, so a failed
+    // read keeps the step in its current storage
+    QByteArray packed = m_packed;
+    if (m_storage == Spilled) {
+        packed = m_journal ? m_journal->read(m_journalOffset, m_journalSize) : QByteArray();
+        if (packed.size() != m_journalSize) {
+            return false;
+        }
+    }
+
+    QByteArray raw = qUncompress(packed);
+    if (raw.isEmpty()) {
+        return false;
+    }
+
+    QVector<TileChange> changes = m_changes;
+    QDataStream stream(raw);
+    for (TileChange &change : changes) {
+        change.before = readTile(stream);
+        change.after = readTile(stream);
+    }
+    if (stream.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    m_changes = changes;
+    m_packed.clear();
+    m_storage = InMemory;
+    return true;
+}
+
+void enforceUndoBudget(const QUndoStack *stack, qint64 budget, UndoJournal *journal)
+{
+    if (!stack || budget <= 0) {
+        return;
+    }
+
+    QVector<const LayerTilesCommand*> commands;
+    QVector<int> positions;
+    for (int i = 0; i < stack->count(); ++i) {
+        const LayerTilesCommand *command = dynamic_cast<const LayerTilesCommand*>(stack->command(i));
+        if (command) {
+            commands.append(command);
+            positions.append(i);
+        }
+    }
+
+    // Tiles still on a layer cost nothing extra, and tiles shared between
+    // steps only count for the first step that holds them
+    QSet<qint64> counted;
+    if (!commands.isEmpty() && commands.first()->document()) {
+        for (const Page &page : commands.first()->document()->pages()) {
+            for (const Layer &layer : page.layers()) {
+                for (int i = 0; i < layer.tileCount(); ++i) {
+                    if (!layer.tileAt(i).isNull()) {
+                        counted.insert(layer.tileAt(i).cacheKey());
+                    }
+                }
+            }
+        }
+    }
+    QVector<qint64> shares(commands.size());
+    qint64 total = 0;
+    for (int i = 0; i < commands.size(); ++i) {
+        shares[i] = commands[i]->byteSize(counted);
+        total += shares[i];
+    }
+
+    // The next undo and redo steps stay in memory so they apply instantly
+    auto isPinned = [&](int i) {
+        return positions[i] == stack->index() - 1 || positions[i] == stack->index();
+    };
+
+    for (int i = 0; i < commands.size() && total > budget; ++i) {
+        // Compressing a step whose tiles are all held elsewhere frees nothing
+        if (!isPinned(i) && shares[i] > 0 && commands[i]->storage() == LayerTilesCommand::InMemory) {
+            total -= shares[i];
+            commands[i]->compress();
+            shares[i] = commands[i]->byteSize();
+            total += shares[i];
+        }
+    }
+
+    for (int i = 0; i < commands.size() && total > budget; ++i) {
+        if (!isPinned(i) && commands[i]->storage() == LayerTilesCommand::Compressed) {
+            total -= shares[i];
+            commands[i]->spill(journal);
+            shares[i] = commands[i]->byteSize();
+            total += shares[i];
+        }
     }
 }
 
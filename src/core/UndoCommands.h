@@ -1,17 +1,22 @@
 #pragma once
 
 #include <QUndoCommand>
-#include <QPixmap>
+#include <QUndoStack>
+#include <QImage>
+#include <QSet>
+#include <QVector>
 
 namespace Unimalen {
 
 class Layer;
+class Document;
+class UndoJournal;
 
 // Command for painting operations on a layer
 class PaintCommand : public QUndoCommand
 {
 public:
-    PaintCommand(Layer *layer, const QPixmap &oldPixmap, const QPixmap &newPixmap,
+    PaintCommand(Layer *layer, const QImage &oldImage, const QImage &newImage,
                  const QString &text = "Paint");
 
     void undo() override;
@@ -19,8 +24,73 @@ public:
 
 private:
     Layer *m_layer;
-    QPixmap m_oldPixmap;
-    QPixmap m_newPixmap;
+    QImage m_oldImage;
+    QImage m_newImage;
 };
 
+// Command that records only the tiles of one layer changed by an edit.
+// Tiles are implicitly shared with the layer, so a step costs memory in
+// proportion to the edited area rather than the page. Older steps can be
+// compressed or spilled to an UndoJournal, they are restored on demand.
+class LayerTilesCommand : public QUndoCommand
+{
+public:
+    enum Storage {
+        InMemory,
+        Compressed,
+        Spilled
+    };
+
+    // before is the layer's tiles() from when the edit started, the changes
+    // are found by comparing it against the layer's current tiles
+    LayerTilesCommand(Document *document, quint64 layerId, const QVector<QImage> &before,
+                      const QString &text = "Paint");
+
+    bool isEmpty() const { return m_changes.isEmpty(); }
+    quint64 layerId() const { return m_layerId; }
+    const Document* document() const { return m_document; }
+    QVector<int> changedTiles() const;
+
+    // Storage management, const as it does not change what the command does
+    Storage storage() const { return m_storage; }
+    // Bytes currently held in memory. Tiles are implicitly shared with the
+    // layer and neighbouring steps; those whose cache key is already in
+    // counted are skipped and the rest are added to it.
+    qint64 byteSize() const;
+    qint64 byteSize(QSet<qint64> &counted) const;
+    void compress() const;
+    void spill(UndoJournal *journal) const;
+
+    void undo() override;
+    void redo() override;
+
+private:
+    struct TileChange
+    {
+        int index;
+        QImage before;
+        QImage after;
+    };
+
+    void apply(bool after);
+    bool restore() const; // False if the stored tiles could not be read back
+
+    Document *m_document;
+    quint64 m_layerId;
+    int m_tileCount;
+    mutable QVector<TileChange> m_changes;
+    bool m_firstRedo;
+
+    mutable Storage m_storage;
+    mutable QByteArray m_packed;
+    mutable UndoJournal *m_journal;
+    mutable qint64 m_journalOffset;
+    mutable qint64 m_journalSize;
+};
+
+// Keeps the commands of an undo stack within budget bytes by compressing
+// the oldest steps first and spilling them to the journal if that is not
+// enough. The steps next to the current index are left alone.
+void enforceUndoBudget(const QUndoStack *stack, qint64 budget, UndoJournal *journal);
+
 } // namespace Unimalen
@@ -0,0 +1,43 @@
+#include "UndoJournal.h"
+#include <QDir>
+
+namespace Unimalen {
+
+bool UndoJournal::ensureOpen()
+{
+    if (m_file.isOpen()) {
+        return true;
+    }
+    m_file.setFileTemplate(QDir::tempPath() + "/grfx-undo-XXXXXX.journal");
+    return m_file.open();
+}
+
+qint64 UndoJournal::append(const QByteArray &data)
+{
+    if (!ensureOpen()) {
+        return -1;
+    }
+
+    qint64 offset = m_file.size();
+    if (!m_file.seek(offset) || m_file.write(data) != data.size()) {
+        return -1;
+    }
+    return offset;
+}
+
+QByteArray UndoJournal::read(qint64 offset, qint64 size)
+{
+    if (!m_file.isOpen() || !m_file.seek(offset)) {
+        return QByteArray();
+    }
+    return m_file.read(size);
+}
+
+void UndoJournal::reset()
+{
+    if (m_file.isOpen()) {
+        m_file.resize(0);
+    }
+}
+
+} // namespace Unimalen
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QByteArray>
+#include <QTemporaryFile>
+
+namespace Unimalen {
+
+// Append-only temporary file holding undo data that was pushed out of
+// memory. Space is only reclaimed by reset(), when the undo stack is cleared.
+class UndoJournal
+{
+public:
+    UndoJournal() = default;
+
+    // Returns the offset the data was written at, or -1 on failure
+    qint64 append(const QByteArray &data);
+    QByteArray read(qint64 offset, qint64 size);
+    void reset();
+
+    qint64 size() const { return m_file.isOpen() ? m_file.size() : 0; }
+
+private:
+    bool ensureOpen();
+
+    QTemporaryFile m_file;
+};
+
+} // namespace Unimalen
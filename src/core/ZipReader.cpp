@@ -0,0 +1,168 @@
+#include "ZipReader.h"
+#include <QtEndian>
+#include <zlib.h>
+
+namespace Unimalen {
+
+static quint16 readUInt16(const uchar *data)
+{
+    return qFromLittleEndian<quint16>(data);
+}
+
+static quint32 readUInt32(const uchar *data)
+{
+    return qFromLittleEndian<quint32>(data);
+}
+
+// Inflate a raw deflate stream (no zlib header or trailer) of known size
+static bool inflateRaw(const uchar *data, quint32 size, QByteArray &out)
+{
+    z_stream stream = {};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        return false;
+    }
+
+    stream.next_in = const_cast<Bytef*>(data);
+    stream.avail_in = uInt(size);
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = uInt(out.size());
+
+    int result = inflate(&stream, Z_FINISH);
+    bool complete = result == Z_STREAM_END && stream.total_out == uLong(out.size());
+    inflateEnd(&stream);
+    return complete;
+}
+
+ZipReader::ZipReader(const QString &fileName)
+    : m_file(fileName)
+    , m_data(nullptr)
+    , m_size(0)
+{
+}
+
+ZipReader::~ZipReader()
+{
+    close();
+}
+
+bool ZipReader::open()
+{
+    close();
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    m_size = m_file.size();
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        // Fall back to a single read when the file cannot be mapped
+        m_buffer = m_file.readAll();
+        m_data = reinterpret_cast<const uchar*>(m_buffer.constData());
+        m_size = m_buffer.size();
+    }
+
+    if (!readCentralDirectory()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void ZipReader::close()
+{
+    m_entries.clear();
+    m_buffer.clear();
+    m_data = nullptr;
+    m_size = 0;
+    if (m_file.isOpen()) {
+        m_file.close(); // Also unmaps
+    }
+}
+
+bool ZipReader::readCentralDirectory()
+{
+    // The end of central directory record sits at the end, followed by an
+    // optional comment of up to 64 KB
+    const qint64 endSize = 22;
+    qint64 end = -1;
+    for (qint64 pos = m_size - endSize; pos >= 0 && pos >= m_size - endSize - 0xffff; --pos) {
+        if (readUInt32(m_data + pos) == 0x06054b50) {
+            end = pos;
+            break;
+        }
+    }
+    if (end < 0) {
+        return false;
+    }
+
+    int count = readUInt16(m_data + end + 10);
+    qint64 pos = readUInt32(m_data + end + 16);
+
+    for (int i = 0; i < count; ++i) {
+        if (pos + 46 > m_size || readUInt32(m_data + pos) != 0x02014b50) {
+            return false;
+        }
+
+        Entry entry;
+        entry.method = readUInt16(m_data + pos + 10);
+        entry.crc = readUInt32(m_data + pos + 16);
+        entry.compressedSize = readUInt32(m_data + pos + 20);
+        entry.uncompressedSize = readUInt32(m_data + pos + 24);
+        int nameLength = readUInt16(m_data + pos + 28);
+        int extraLength = readUInt16(m_data + pos + 30);
+        int commentLength = readUInt16(m_data + pos + 32);
+        entry.localOffset = readUInt32(m_data + pos + 42);
+
+        if (pos + 46 + nameLength > m_size) {
+            return false;
+        }
+        QString name = QString::fromUtf8(reinterpret_cast<const char*>(m_data + pos + 46), nameLength);
+        if (!name.endsWith('/')) {
+            m_entries.insert(name, entry);
+        }
+
+        pos += 46 + nameLength + extraLength + commentLength;
+    }
+    return true;
+}
+
+QByteArray ZipReader::fileData(const QString &name) const
+{
+    auto it = m_entries.constFind(name);
+    if (it == m_entries.constEnd()) {
+        return QByteArray();
+    }
+    const Entry &entry = it.value();
+
+    // Sizes in the local header may be deferred to a data descriptor, so
+    // only its name and extra lengths are taken from it
+    qint64 pos = entry.localOffset;
+    if (pos + 30 > m_size || readUInt32(m_data + pos) != 0x04034b50) {
+        return QByteArray();
+    }
+    pos += 30 + readUInt16(m_data + pos + 26) + readUInt16(m_data + pos + 28);
+    if (pos + entry.compressedSize > m_size) {
+        return QByteArray();
+    }
+
+    QByteArray data;
+    if (entry.method == 0) {
+        data = QByteArray(reinterpret_cast<const char*>(m_data + pos), int(entry.compressedSize));
+    } else if (entry.method == 8) {
+        data.resize(int(entry.uncompressedSize));
+        if (!inflateRaw(m_data + pos, entry.compressedSize, data)) {
+            return QByteArray();
+        }
+    } else {
+        return QByteArray();
+    }
+
+    quint32 crc = quint32(crc32(crc32(0, nullptr, 0),
+                                reinterpret_cast<const Bytef*>(data.constData()), uInt(data.size())));
+    if (crc != entry.crc) {
+        return QByteArray();
+    }
+    return data;
+}
+
+} // namespace Unimalen
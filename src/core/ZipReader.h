@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+
+namespace Unimalen {
+
+// Minimal ZIP archive reader. The archive is mapped (or read) once by open()
+// and entries are inflated from memory, so fileData() is safe to call from
+// several threads at the same time.
+class ZipReader
+{
+public:
+    explicit ZipReader(const QString &fileName);
+    ~ZipReader();
+
+    bool open();
+    void close();
+
+    bool contains(const QString &name) const { return m_entries.contains(name); }
+    QStringList fileNames() const { return m_entries.keys(); }
+    // Returns a null array if the entry is missing or corrupt
+    QByteArray fileData(const QString &name) const;
+
+private:
+    struct Entry {
+        quint16 method;
+        quint32 crc;
+        quint32 compressedSize;
+        quint32 uncompressedSize;
+        quint32 localOffset;
+    };
+
+    bool readCentralDirectory();
+
+    QFile m_file;
+    QByteArray m_buffer;
+    const uchar *m_data;
+    qint64 m_size;
+    QHash<QString, Entry> m_entries;
+};
+
+} // namespace Unimalen
@@ -0,0 +1,173 @@
+#include "ZipWriter.h"
+#include <QDateTime>
+#include <QtEndian>
+#include <zlib.h>
+
+namespace Unimalen {
+
+static void appendUInt16(QByteArray &out, quint16 value)
+{
+    char bytes[2];
+    qToLittleEndian(value, bytes);
+    out.append(bytes, 2);
+}
+
+static void appendUInt32(QByteArray &out, quint32 value)
+{
+    char bytes[4];
+    qToLittleEndian(value, bytes);
+    out.append(bytes, 4);
+}
+
+// Raw deflate stream as stored in ZIP entries (no zlib header or trailer)
+static bool deflateRaw(const QByteArray &data, QByteArray &out)
+{
+    z_stream stream = {};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+
+    out.resize(int(deflateBound(&stream, uLong(data.size()))));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+    stream.avail_in = uInt(data.size());
+    stream.next_out = reinterpret_cast<Bytef*>(out.data());
+    stream.avail_out = uInt(out.size());
+
+    int result = deflate(&stream, Z_FINISH);
+    out.resize(int(stream.total_out));
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+ZipWriter::ZipWriter(const QString &fileName)
+    : m_file(fileName)
+    , m_dosTime(0)
+    , m_dosDate(0)
+    , m_error(false)
+{
+    QDateTime now = QDateTime::currentDateTime();
+    QDate date = now.date();
+    QTime time = now.time();
+    m_dosTime = quint16((time.hour() << 11) | (time.minute() << 5) | (time.second() / 2));
+    m_dosDate = quint16(((qMax(date.year(), 1980) - 1980) << 9) | (date.month() << 5) | date.day());
+}
+
+ZipWriter::~ZipWriter()
+{
+    // An archive that was never closed is incomplete, keep the old file
+    if (m_file.isOpen()) {
+        m_file.cancelWriting();
+    }
+}
+
+bool ZipWriter::open()
+{
+    m_entries.clear();
+    m_error = !m_file.open(QIODevice::WriteOnly);
+    return !m_error;
+}
+
+bool ZipWriter::write(const QByteArray &data)
+{
+    if (!m_error && m_file.write(data) != data.size()) {
+        m_error = true;
+    }
+    return !m_error;
+}
+
+bool ZipWriter::addFile(const QString &name, const QByteArray &data, Compression compression)
+{
+    if (m_error || !m_file.isOpen()) {
+        return false;
+    }
+
+    Entry entry;
+    entry.name = name.toUtf8();
+    entry.crc = quint32(crc32(crc32(0, nullptr, 0),
+                              reinterpret_cast<const Bytef*>(data.constData()), uInt(data.size())));
+    entry.uncompressedSize = quint32(data.size());
+    entry.offset = quint32(m_file.pos());
+
+    QByteArray payload;
+    if (compression == Deflated && deflateRaw(data, payload) && payload.size() < data.size()) {
+        entry.method = 8;
+    } else {
+        // Already compressed data such as PNG gains nothing from deflate
+        entry.method = 0;
+        payload = data;
+    }
+    entry.compressedSize = quint32(payload.size());
+
+    QByteArray header;
+    appendUInt32(header, 0x04034b50);
+    appendUInt16(header, 20);            // Version needed to extract
+    appendUInt16(header, 0x0800);        // UTF-8 file names
+    appendUInt16(header, entry.method);
+    appendUInt16(header, m_dosTime);
+    appendUInt16(header, m_dosDate);
+    appendUInt32(header, entry.crc);
+    appendUInt32(header, entry.compressedSize);
+    appendUInt32(header, entry.uncompressedSize);
+    appendUInt16(header, quint16(entry.name.size()));
+    appendUInt16(header, 0);             // Extra field length
+    header.append(entry.name);
+
+    if (!write(header) || !write(payload)) {
+        return false;
+    }
+
+    m_entries.append(entry);
+    return true;
+}
+
+bool ZipWriter::close()
+{
+    if (!m_file.isOpen()) {
+        return !m_error;
+    }
+
+    quint32 directoryOffset = quint32(m_file.pos());
+    QByteArray directory;
+    for (const Entry &entry : m_entries) {
+        appendUInt32(directory, 0x02014b50);
+        appendUInt16(directory, 20);     // Version made by
+        appendUInt16(directory, 20);     // Version needed to extract
+        appendUInt16(directory, 0x0800);
+        appendUInt16(directory, entry.method);
+        appendUInt16(directory, m_dosTime);
+        appendUInt16(directory, m_dosDate);
+        appendUInt32(directory, entry.crc);
+        appendUInt32(directory, entry.compressedSize);
+        appendUInt32(directory, entry.uncompressedSize);
+        appendUInt16(directory, quint16(entry.name.size()));
+        appendUInt16(directory, 0);      // Extra field length
+        appendUInt16(directory, 0);      // Comment length
+        appendUInt16(directory, 0);      // Disk number
+        appendUInt16(directory, 0);      // Internal attributes
+        appendUInt32(directory, 0);      // External attributes
+        appendUInt32(directory, entry.offset);
+        directory.append(entry.name);
+    }
+
+    QByteArray end;
+    appendUInt32(end, 0x06054b50);
+    appendUInt16(end, 0);
+    appendUInt16(end, 0);
+    appendUInt16(end, quint16(m_entries.size()));
+    appendUInt16(end, quint16(m_entries.size()));
+    appendUInt32(end, quint32(directory.size()));
+    appendUInt32(end, directoryOffset);
+    appendUInt16(end, 0);
+
+    write(directory);
+    write(end);
+    if (m_error) {
+        m_file.cancelWriting();
+    }
+    if (!m_file.commit()) {
+        m_error = true;
+    }
+    return !m_error;
+}
+
+} // namespace Unimalen
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QByteArray>
+#include <QSaveFile>
+#include <QString>
+#include <QVector>
+
+namespace Unimalen {
+
+// Minimal ZIP archive writer. Entries are written to the output file as they
+// are added and the central directory is appended by close(). The archive
+// replaces the target file atomically on a successful close() only.
+class ZipWriter
+{
+public:
+    enum Compression {
+        Stored,
+        Deflated
+    };
+
+    explicit ZipWriter(const QString &fileName);
+    ~ZipWriter();
+
+    bool open();
+    bool addFile(const QString &name, const QByteArray &data, Compression compression = Deflated);
+    bool close();
+
+    bool hasError() const { return m_error; }
+
+private:
+    struct Entry {
+        QByteArray name;
+        quint16 method;
+        quint32 crc;
+        quint32 compressedSize;
+        quint32 uncompressedSize;
+        quint32 offset;
+    };
+
+    bool write(const QByteArray &data);
+
+    QSaveFile m_file;
+    QVector<Entry> m_entries;
+    quint16 m_dosTime;
+    quint16 m_dosDate;
+    bool m_error;
+};
+
+} // namespace Unimalen
@@ -369,8 +369,8 @@ void LayerItemWidget::updateFromLayer(const Layer &layer)
         }
     }
 
-    QPixmap scaledLayer = layer.pixmap().scaled(48, 48, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-    bgPainter.drawPixmap((48 - scaledLayer.width()) / 2, (48 - scaledLayer.height()) / 2, scaledLayer);
+    QImage scaledLayer = layer.thumbnail(QSize(48, 48));
+    bgPainter.drawImage((48 - scaledLayer.width()) / 2, (48 - scaledLayer.height()) / 2, scaledLayer);
 
     bgPainter.setPen(QPen(QColor(128, 128, 128), 1));
     bgPainter.setBrush(Qt::NoBrush);
@@ -473,8 +473,8 @@ void LayerItem::updateFromLayer(const Layer &layer)
     }
 
     // Draw scaled layer content
-    QPixmap scaledLayer = layer.pixmap().scaled(48, 48, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-    bgPainter.drawPixmap((48 - scaledLayer.width()) / 2, (48 - scaledLayer.height()) / 2, scaledLayer);
+    QImage scaledLayer = layer.thumbnail(QSize(48, 48));
+    bgPainter.drawImage((48 - scaledLayer.width()) / 2, (48 - scaledLayer.height()) / 2, scaledLayer);
 
     // Draw border around thumbnail
     bgPainter.setPen(QPen(QColor(128, 128, 128), 1));
@@ -28,6 +28,7 @@
 #include <QPushButton>
 #include <QComboBox>
 #include <QGroupBox>
+#include <QSlider>
 
 // Define static const
 const int MainWindow::MaxRecentFiles;
@@ -35,6 +36,10 @@ const int MainWindow::MaxRecentFiles;
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , m_currentFile("")
+    , m_undoBudgetMB(Unimalen::DEFAULT_UNDO_BUDGET_MB)
+    , m_fillTolerance(0)
+    , m_fillGapSize(0)
+    , m_wandTolerance(32)
 {
     m_tabWidget = new TabWidget(this);
     m_toolBar = new ToolBar(this);
@@ -128,9 +133,9 @@ MainWindow::MainWindow(QWidget *parent)
     m_statusCanvasSizeLabel->setMinimumWidth(150);
     statusBar()->addWidget(m_statusCanvasSizeLabel);
 
-    m_statusMemoryLabel = new QLabel("Memory: ~50MB", this);
+    m_statusMemoryLabel = new QLabel("Memory: 0.0MB", this);
     m_statusMemoryLabel->setFrameStyle(QFrame::Panel | QFrame::Sunken);
-    m_statusMemoryLabel->setMinimumWidth(120);
+    m_statusMemoryLabel->setMinimumWidth(200);
     statusBar()->addWidget(m_statusMemoryLabel);
 
     // Connect toolbar signals
@@ -184,15 +189,11 @@ MainWindow::MainWindow(QWidget *parent)
     // Initialize preferences and auto-save
     loadPreferences();
     m_autoSaveTimer = new QTimer(this);
-    connect(m_autoSaveTimer, &QTimer::timeout, this, [this]() {
-        if (m_autoSaveEnabled) {
-            Canvas *canvas = getCurrentCanvas();
-            if (canvas && canvas->isModified() && !m_currentFile.isEmpty()) {
-                canvas->saveCanvas(m_currentFile + ".autosave");
-            }
-        }
-    });
+    connect(m_autoSaveTimer, &QTimer::timeout, this, &MainWindow::autoSave);
     applyAutoSaveSettings();
+    applyUndoSettings();
+    applyFillSettings();
+    QTimer::singleShot(0, this, &MainWindow::recoverDocuments);
 
     setWindowTitle(tr("grfx - Untitled"));
     resize(800, 600);
@@ -318,14 +319,22 @@ void MainWindow::createActions()
     m_undoAction->setShortcut(QKeySequence::Undo);
     connect(m_undoAction, &QAction::triggered, this, [this]() {
         Canvas *canvas = getCurrentCanvas();
-        if (canvas) canvas->undo();
+        if (canvas) {
+            canvas->undo();
+            // Undo can switch to the page the edit was made on
+            updatePageIndicator();
+        }
     });
 
     m_redoAction = new QAction(tr("&Redo"), this);
     m_redoAction->setShortcut(QKeySequence::Redo);
     connect(m_redoAction, &QAction::triggered, this, [this]() {
         Canvas *canvas = getCurrentCanvas();
-        if (canvas) canvas->redo();
+        if (canvas) {
+            canvas->redo();
+            // Undo can switch to the page the edit was made on
+            updatePageIndicator();
+        }
     });
 
     m_cutAction = new QAction(tr("Cu&t"), this);
@@ -361,6 +370,17 @@ void MainWindow::createActions()
     m_flipSelectionVerticalAction->setShortcut(QKeySequence("Ctrl+Alt+V"));
     connect(m_flipSelectionVerticalAction, &QAction::triggered, this, &MainWindow::onFlipSelectionVertical);
 
+    m_magicWandAction = new QAction(tr("&Magic Wand"), this);
+    m_magicWandAction->setShortcut(QKeySequence("Ctrl+Alt+W"));
+    connect(m_magicWandAction, &QAction::triggered, this, &MainWindow::onMagicWandSelected);
+
+    m_selectByColorAction = new QAction(tr("Select by &Color"), this);
+    m_selectByColorAction->setShortcut(QKeySequence("Ctrl+Alt+Shift+W"));
+    connect(m_selectByColorAction, &QAction::triggered, this, &MainWindow::onSelectByColorSelected);
+
+    m_wandToleranceAction = new QAction(tr("Selection &Tolerance..."), this);
+    connect(m_wandToleranceAction, &QAction::triggered, this, &MainWindow::showWandTolerance);
+
     // Zoom actions
     m_zoom25Action = new QAction("25%", this);
     m_zoom25Action->setCheckable(true);
@@ -752,6 +772,10 @@ void MainWindow::createMenus()
     transformMenu->addAction(m_flipSelectionHorizontalAction);
     transformMenu->addAction(m_flipSelectionVerticalAction);
     editMenu->addSeparator();
+    editMenu->addAction(m_magicWandAction);
+    editMenu->addAction(m_selectByColorAction);
+    editMenu->addAction(m_wandToleranceAction);
+    editMenu->addSeparator();
     editMenu->addAction(m_preferencesAction);
 
     QMenu *imageMenu = menuBar()->addMenu(tr("&Image"));
@@ -869,9 +893,9 @@ void MainWindow::newFile()
 void MainWindow::newFromClipboard()
 {
     QClipboard *clipboard = QApplication::clipboard();
-    QPixmap pixmap = clipboard->pixmap();
+    QImage image = clipboard->image();
 
-    if (pixmap.isNull()) {
+    if (image.isNull()) {
         QMessageBox::information(this, "New from Clipboard", "No image data in clipboard.");
         return;
     }
@@ -884,7 +908,7 @@ void MainWindow::newFromClipboard()
         canvas->newCanvas();
 
         // Insert the clipboard image at position (0,0)
-        canvas->insertImageAt(pixmap, QPoint(0, 0));
+        canvas->insertImageAt(image, QPoint(0, 0));
 
         setCurrentFile("");
         setWindowTitle(tr("grfx - New from Clipboard"));
@@ -895,7 +919,7 @@ void MainWindow::openFile()
 {
     QString fileName = QFileDialog::getOpenFileName(this,
         "Open Image", QStandardPaths::writableLocation(QStandardPaths::PicturesLocation),
-        "OpenRaster Files (*.ora);;PNG Files (*.png);;All Files (*)");
+        "grfx Documents (*.grfx);;OpenRaster Files (*.ora);;PNG Files (*.png);;All Files (*)");
 
     if (!fileName.isEmpty()) {
         if (m_tabWidget->loadDocument(fileName)) {
@@ -921,7 +945,7 @@ void MainWindow::saveAsFile()
 {
     QString fileName = QFileDialog::getSaveFileName(this,
         "Save Image", QStandardPaths::writableLocation(QStandardPaths::PicturesLocation),
-        "OpenRaster Files (*.ora);;PNG Files (*.png);;JPEG Files (*.jpg);;BMP Files (*.bmp);;GIF Files (*.gif)");
+        "grfx Documents (*.grfx);;OpenRaster Files (*.ora);;PNG Files (*.png);;JPEG Files (*.jpg);;BMP Files (*.bmp);;GIF Files (*.gif)");
 
     if (!fileName.isEmpty()) {
         if (m_tabWidget->saveCurrentDocument(fileName)) {
@@ -1104,10 +1128,22 @@ void MainWindow::updateStatusBar()
             m_statusCanvasSizeLabel->setText(QString("Canvas: 576x720"));
         }
 
-        // Update memory usage (simplified)
+        // Update memory usage across all open documents
         if (m_statusMemoryLabel) {
-            // In a real implementation, you'd calculate actual memory usage
-            m_statusMemoryLabel->setText(QString("Memory: ~50MB"));
+            qint64 totalBytes = 0;
+            qint64 sharedBytes = 0;
+            for (int i = 0; i < m_tabWidget->count(); ++i) {
+                Canvas *tabCanvas = m_tabWidget->canvasAt(i);
+                if (tabCanvas) {
+                    Unimalen::MemoryStats stats = tabCanvas->document()->memoryStats();
+                    totalBytes += stats.totalBytes();
+                    sharedBytes += stats.sharedBytes;
+                }
+            }
+            const double mb = 1024.0 * 1024.0;
+            m_statusMemoryLabel->setText(QString("Memory: %1MB (%2MB shared)")
+                .arg(totalBytes / mb, 0, 'f', 1)
+                .arg(sharedBytes / mb, 0, 'f', 1));
         }
     }
 }
@@ -1274,6 +1310,61 @@ void MainWindow::onFlipSelectionVertical()
     if (canvas) canvas->flipSelectionVertical();
 }
 
+void MainWindow::onMagicWandSelected()
+{
+    Canvas *canvas = getCurrentCanvas();
+    if (canvas) canvas->setMagicWandMode(true, true);
+}
+
+void MainWindow::onSelectByColorSelected()
+{
+    Canvas *canvas = getCurrentCanvas();
+    if (canvas) canvas->setMagicWandMode(true, false);
+}
+
+void MainWindow::showWandTolerance()
+{
+    Canvas *canvas = getCurrentCanvas();
+
+    QDialog dialog(this);
+    dialog.setWindowTitle(tr("Selection Tolerance"));
+
+    QFormLayout *formLayout = new QFormLayout;
+
+    // The current wand selection follows the slider as it moves
+    QSlider *toleranceSlider = new QSlider(Qt::Horizontal, &dialog);
+    toleranceSlider->setRange(0, 255);
+    toleranceSlider->setValue(m_wandTolerance);
+    QLabel *valueLabel = new QLabel(QString::number(m_wandTolerance), &dialog);
+    QHBoxLayout *sliderLayout = new QHBoxLayout();
+    sliderLayout->addWidget(toleranceSlider);
+    sliderLayout->addWidget(valueLabel);
+    formLayout->addRow(tr("Tolerance:"), sliderLayout);
+
+    connect(toleranceSlider, &QSlider::valueChanged, &dialog, [canvas, valueLabel](int value) {
+        valueLabel->setNum(value);
+        if (canvas) {
+            canvas->setWandTolerance(value);
+        }
+    });
+
+    QDialogButtonBox *buttonBox = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog);
+    connect(buttonBox, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(buttonBox, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+
+    QVBoxLayout *mainLayout = new QVBoxLayout(&dialog);
+    mainLayout->addLayout(formLayout);
+    mainLayout->addWidget(buttonBox);
+
+    if (dialog.exec() == QDialog::Accepted) {
+        m_wandTolerance = toleranceSlider->value();
+        savePreferences();
+    }
+    if (canvas) {
+        canvas->setWandTolerance(m_wandTolerance);
+    }
+}
+
 void MainWindow::onFontChanged(const QString &fontFamily)
 {
     Canvas *canvas = getCurrentCanvas();
@@ -1388,6 +1479,10 @@ void MainWindow::loadPreferences()
     QSettings settings("grfx", "grfx");
     m_autoSaveEnabled = settings.value("autoSave/enabled", true).toBool();
     m_autoSaveInterval = settings.value("autoSave/interval", 5).toInt(); // Default 5 minutes
+    m_undoBudgetMB = settings.value("undo/budgetMB", Unimalen::DEFAULT_UNDO_BUDGET_MB).toInt();
+    m_fillTolerance = settings.value("fill/tolerance", 0).toInt();
+    m_fillGapSize = settings.value("fill/gapSize", 0).toInt();
+    m_wandTolerance = settings.value("select/tolerance", 32).toInt();
 }
 
 void MainWindow::savePreferences()
@@ -1395,6 +1490,75 @@ void MainWindow::savePreferences()
     QSettings settings("grfx", "grfx");
     settings.setValue("autoSave/enabled", m_autoSaveEnabled);
     settings.setValue("autoSave/interval", m_autoSaveInterval);
+    settings.setValue("undo/budgetMB", m_undoBudgetMB);
+    settings.setValue("fill/tolerance", m_fillTolerance);
+    settings.setValue("fill/gapSize", m_fillGapSize);
+    settings.setValue("select/tolerance", m_wandTolerance);
+}
+
+void MainWindow::autoSave()
+{
+    // Edits are journaled as they happen, the timer only compacts journals
+    // that grew large or missed changes made outside the undo stack
+    for (int i = 0; i < m_tabWidget->count(); ++i) {
+        Canvas *canvas = m_tabWidget->canvasAt(i);
+        if (canvas) {
+            canvas->compactRecovery();
+        }
+    }
+}
+
+QString MainWindow::recoveryDirectory() const
+{
+    if (!m_autoSaveEnabled) {
+        return QString();
+    }
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/recovery";
+}
+
+void MainWindow::recoverDocuments()
+{
+    QString directory = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/recovery";
+    QStringList pending = Unimalen::RecoveryJournal::pendingRecoveries(directory);
+    if (pending.isEmpty()) {
+        return;
+    }
+
+    QMessageBox::StandardButton answer = QMessageBox::question(this, tr("Recover Documents"),
+        tr("grfx did not shut down cleanly. Recover %n unsaved document(s)?", "", pending.size()),
+        QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes);
+
+    // Journals are only dropped once recovered or declined. Ones that fail
+    // to replay stay on disk, they may be the only copy of the work.
+    QStringList failed;
+    for (const QString &basePath : pending) {
+        if (answer == QMessageBox::Yes) {
+            m_tabWidget->newTab();
+            Canvas *canvas = getCurrentCanvas();
+            if (!canvas) {
+                failed.append(basePath);
+                continue;
+            }
+            canvas->setRecoveryDirectory(recoveryDirectory());
+            if (!canvas->recoverFrom(basePath)) {
+                m_tabWidget->closeTab(m_tabWidget->currentIndex());
+                failed.append(basePath);
+                continue;
+            }
+        }
+        Unimalen::RecoveryJournal::removeFiles(basePath);
+    }
+
+    if (answer == QMessageBox::Yes) {
+        updatePageIndicator();
+        updateStatusBar();
+    }
+
+    if (!failed.isEmpty()) {
+        QMessageBox::warning(this, tr("Recover Documents"),
+            tr("%n document(s) could not be recovered. Their recovery files were kept in:\n%1",
+               "", failed.size()).arg(directory));
+    }
 }
 
 void MainWindow::applyAutoSaveSettings()
@@ -1404,6 +1568,37 @@ void MainWindow::applyAutoSaveSettings()
     } else {
         m_autoSaveTimer->stop();
     }
+
+    // Turning auto-save off also stops journaling and drops the journals
+    for (int i = 0; i < m_tabWidget->count(); ++i) {
+        Canvas *canvas = m_tabWidget->canvasAt(i);
+        if (canvas) {
+            canvas->setRecoveryDirectory(recoveryDirectory());
+        }
+    }
+}
+
+void MainWindow::applyUndoSettings()
+{
+    for (int i = 0; i < m_tabWidget->count(); ++i) {
+        Canvas *canvas = m_tabWidget->canvasAt(i);
+        if (canvas) {
+            canvas->setUndoBudget(qint64(m_undoBudgetMB) * 1024 * 1024);
+        }
+    }
+}
+
+void MainWindow::applyFillSettings()
+{
+    Unimalen::FillOptions options;
+    options.tolerance = m_fillTolerance;
+    options.gapSize = m_fillGapSize;
+    for (int i = 0; i < m_tabWidget->count(); ++i) {
+        Canvas *canvas = m_tabWidget->canvasAt(i);
+        if (canvas) {
+            canvas->setFillOptions(options);
+        }
+    }
 }
 
 void MainWindow::showPreferences()
@@ -1423,7 +1618,7 @@ void MainWindow::showPreferences()
     autoSaveLayout->addWidget(autoSaveCheckBox);
 
     QHBoxLayout *intervalLayout = new QHBoxLayout();
-    QLabel *intervalLabel = new QLabel(tr("Save interval:"), autoSaveGroup);
+    QLabel *intervalLabel = new QLabel(tr("Compact journal every:"), autoSaveGroup);
     QSpinBox *intervalSpinBox = new QSpinBox(autoSaveGroup);
     intervalSpinBox->setRange(1, 60);
     intervalSpinBox->setValue(m_autoSaveInterval);
@@ -1433,12 +1628,66 @@ void MainWindow::showPreferences()
     intervalLayout->addStretch();
     autoSaveLayout->addLayout(intervalLayout);
 
-    QLabel *infoLabel = new QLabel(tr("Auto-save files are saved with .autosave extension"), autoSaveGroup);
+    QLabel *infoLabel = new QLabel(tr("Changes are journaled as you draw and recovered after a crash"), autoSaveGroup);
     infoLabel->setStyleSheet("color: gray; font-size: 10px;");
     autoSaveLayout->addWidget(infoLabel);
 
     mainLayout->addWidget(autoSaveGroup);
 
+    // Undo history group
+    QGroupBox *undoGroup = new QGroupBox(tr("Undo History"), &dialog);
+    QVBoxLayout *undoLayout = new QVBoxLayout(undoGroup);
+
+    QHBoxLayout *budgetLayout = new QHBoxLayout();
+    QLabel *budgetLabel = new QLabel(tr("Memory per document:"), undoGroup);
+    QSpinBox *budgetSpinBox = new QSpinBox(undoGroup);
+    budgetSpinBox->setRange(16, 4096);
+    budgetSpinBox->setSingleStep(16);
+    budgetSpinBox->setValue(m_undoBudgetMB);
+    budgetSpinBox->setSuffix(tr(" MB"));
+    budgetLayout->addWidget(budgetLabel);
+    budgetLayout->addWidget(budgetSpinBox);
+    budgetLayout->addStretch();
+    undoLayout->addLayout(budgetLayout);
+
+    QLabel *undoInfoLabel = new QLabel(tr("Older steps are compressed, then moved to a temporary file"), undoGroup);
+    undoInfoLabel->setStyleSheet("color: gray; font-size: 10px;");
+    undoLayout->addWidget(undoInfoLabel);
+
+    mainLayout->addWidget(undoGroup);
+
+    // Fill tool group
+    QGroupBox *fillGroup = new QGroupBox(tr("Fill"), &dialog);
+    QVBoxLayout *fillLayout = new QVBoxLayout(fillGroup);
+
+    QHBoxLayout *toleranceLayout = new QHBoxLayout();
+    QLabel *toleranceLabel = new QLabel(tr("Color tolerance:"), fillGroup);
+    QSpinBox *toleranceSpinBox = new QSpinBox(fillGroup);
+    toleranceSpinBox->setRange(0, 255);
+    toleranceSpinBox->setValue(m_fillTolerance);
+    toleranceLayout->addWidget(toleranceLabel);
+    toleranceLayout->addWidget(toleranceSpinBox);
+    toleranceLayout->addStretch();
+    fillLayout->addLayout(toleranceLayout);
+
+    QHBoxLayout *gapLayout = new QHBoxLayout();
+    QLabel *gapLabel = new QLabel(tr("Close gaps up to:"), fillGroup);
+    QSpinBox *gapSpinBox = new QSpinBox(fillGroup);
+    gapSpinBox->setRange(0, 16);
+    gapSpinBox->setValue(m_fillGapSize);
+    gapSpinBox->setSuffix(tr(" px"));
+    gapSpinBox->setSpecialValueText(tr("Off"));
+    gapLayout->addWidget(gapLabel);
+    gapLayout->addWidget(gapSpinBox);
+    gapLayout->addStretch();
+    fillLayout->addLayout(gapLayout);
+
+    QLabel *fillInfoLabel = new QLabel(tr("Stops fills from leaking through small breaks in line art"), fillGroup);
+    fillInfoLabel->setStyleSheet("color: gray; font-size: 10px;");
+    fillLayout->addWidget(fillInfoLabel);
+
+    mainLayout->addWidget(fillGroup);
+
     // Dialog buttons
     QDialogButtonBox *buttonBox = new QDialogButtonBox(
         QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog);
@@ -1450,8 +1699,13 @@ void MainWindow::showPreferences()
         // Save preferences
         m_autoSaveEnabled = autoSaveCheckBox->isChecked();
         m_autoSaveInterval = intervalSpinBox->value();
+        m_undoBudgetMB = budgetSpinBox->value();
+        m_fillTolerance = toleranceSpinBox->value();
+        m_fillGapSize = gapSpinBox->value();
         savePreferences();
         applyAutoSaveSettings();
+        applyUndoSettings();
+        applyFillSettings();
 
         QMessageBox::information(this, tr("Preferences"),
             tr("Preferences saved successfully!"));
@@ -1546,6 +1800,7 @@ void MainWindow::onLayerDuplicated(int index)
     Canvas *canvas = getCurrentCanvas();
     if (canvas) {
         canvas->duplicateLayer(index);
+        updateStatusBar();
     }
 }
 
@@ -1617,6 +1872,15 @@ void MainWindow::connectCanvasSignals(Canvas *canvas)
         return;
     }
 
+    // New tabs pick up the undo budget and fill options when they first become current
+    canvas->setUndoBudget(qint64(m_undoBudgetMB) * 1024 * 1024);
+    canvas->setRecoveryDirectory(recoveryDirectory());
+    Unimalen::FillOptions fillOptions;
+    fillOptions.tolerance = m_fillTolerance;
+    fillOptions.gapSize = m_fillGapSize;
+    canvas->setFillOptions(fillOptions);
+    canvas->setWandTolerance(m_wandTolerance);
+
     // Disconnect from previous canvas
     disconnect(this, SLOT(m_undoAction));
     disconnect(this, SLOT(m_redoAction));
@@ -1800,7 +2064,7 @@ void MainWindow::insertImage()
     if (!fileName.isEmpty()) {
         Canvas *canvas = getCurrentCanvas();
         if (canvas) {
-            QPixmap image(fileName);
+            QImage image(fileName);
             if (image.isNull()) {
                 QMessageBox::warning(this, tr("Insert Image"), tr("Cannot load image file."));
                 return;
@@ -1820,10 +2084,9 @@ void MainWindow::convertToBlackAndWhite()
 
     // Get the current layer
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    // Convert to QImage for pixel manipulation
-    QImage image = layerPixmap.toImage();
+    QImage image = layerImage;
     if (image.isNull()) return;
 
     // Create dialog for threshold adjustment
@@ -1874,7 +2137,7 @@ void MainWindow::convertToBlackAndWhite()
         }
 
         // Apply the converted image back to the layer
-        currentLayer.pixmap() = QPixmap::fromImage(image);
+        currentLayer.setImage(image);
 
         // Update the canvas
         canvas->compositeAllLayers();
@@ -1890,12 +2153,12 @@ void MainWindow::rotateClockwise()
 
     // Get the current layer
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    // Rotate the pixmap 90 degrees clockwise
+    // Rotate the layer 90 degrees clockwise
     QTransform transform;
     transform.rotate(90);
-    currentLayer.pixmap() = layerPixmap.transformed(transform);
+    currentLayer.setImage(layerImage.transformed(transform));
 
     // Update the canvas
     canvas->compositeAllLayers();
@@ -1910,12 +2173,12 @@ void MainWindow::rotateCounterClockwise()
 
     // Get the current layer
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    // Rotate the pixmap 90 degrees counter-clockwise
+    // Rotate the layer 90 degrees counter-clockwise
     QTransform transform;
     transform.rotate(-90);
-    currentLayer.pixmap() = layerPixmap.transformed(transform);
+    currentLayer.setImage(layerImage.transformed(transform));
 
     // Update the canvas
     canvas->compositeAllLayers();
@@ -1930,12 +2193,12 @@ void MainWindow::rotate180()
 
     // Get the current layer
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    // Rotate the pixmap 180 degrees
+    // Rotate the layer 180 degrees
     QTransform transform;
     transform.rotate(180);
-    currentLayer.pixmap() = layerPixmap.transformed(transform);
+    currentLayer.setImage(layerImage.transformed(transform));
 
     // Update the canvas
     canvas->compositeAllLayers();
@@ -1950,12 +2213,12 @@ void MainWindow::flipHorizontal()
 
     // Get the current layer
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    // Flip the pixmap horizontally
+    // Flip the layer horizontally
     QTransform transform;
     transform.scale(-1, 1);
-    currentLayer.pixmap() = layerPixmap.transformed(transform);
+    currentLayer.setImage(layerImage.transformed(transform));
 
     // Update the canvas
     canvas->compositeAllLayers();
@@ -1970,12 +2233,12 @@ void MainWindow::flipVertical()
 
     // Get the current layer
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    // Flip the pixmap vertically
+    // Flip the layer vertically
     QTransform transform;
     transform.scale(1, -1);
-    currentLayer.pixmap() = layerPixmap.transformed(transform);
+    currentLayer.setImage(layerImage.transformed(transform));
 
     // Update the canvas
     canvas->compositeAllLayers();
@@ -1989,9 +2252,9 @@ void MainWindow::scaleImage()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Scale Image"), tr("No image to scale on current layer."));
         return;
     }
@@ -2005,14 +2268,14 @@ void MainWindow::scaleImage()
     // Width spinner
     QSpinBox *widthSpinBox = new QSpinBox(&dialog);
     widthSpinBox->setRange(1, 10000);
-    widthSpinBox->setValue(layerPixmap.width());
+    widthSpinBox->setValue(layerImage.width());
     widthSpinBox->setSuffix(tr(" px"));
     formLayout->addRow(tr("Width:"), widthSpinBox);
 
     // Height spinner
     QSpinBox *heightSpinBox = new QSpinBox(&dialog);
     heightSpinBox->setRange(1, 10000);
-    heightSpinBox->setValue(layerPixmap.height());
+    heightSpinBox->setValue(layerImage.height());
     heightSpinBox->setSuffix(tr(" px"));
     formLayout->addRow(tr("Height:"), heightSpinBox);
 
@@ -2027,11 +2290,11 @@ void MainWindow::scaleImage()
     formLayout->addRow(smoothCheckBox);
 
     // Current size label
-    QLabel *currentSizeLabel = new QLabel(tr("Current size: %1 x %2 px").arg(layerPixmap.width()).arg(layerPixmap.height()), &dialog);
+    QLabel *currentSizeLabel = new QLabel(tr("Current size: %1 x %2 px").arg(layerImage.width()).arg(layerImage.height()), &dialog);
     formLayout->addRow(currentSizeLabel);
 
     // Store original aspect ratio
-    double aspectRatio = static_cast<double>(layerPixmap.width()) / layerPixmap.height();
+    double aspectRatio = static_cast<double>(layerImage.width()) / layerImage.height();
 
     // Connect width change to height when aspect ratio is locked
     connect(widthSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), [&](int value) {
@@ -2070,7 +2333,7 @@ void MainWindow::scaleImage()
         Qt::TransformationMode mode = smoothCheckBox->isChecked() ?
             Qt::SmoothTransformation : Qt::FastTransformation;
 
-        currentLayer.pixmap() = layerPixmap.scaled(newWidth, newHeight, Qt::IgnoreAspectRatio, mode);
+        currentLayer.setImage(layerImage.scaled(newWidth, newHeight, Qt::IgnoreAspectRatio, mode));
 
         // Update the canvas
         canvas->compositeAllLayers();
@@ -2085,9 +2348,9 @@ void MainWindow::cropImage()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Crop Image"), tr("No image to crop on current layer."));
         return;
     }
@@ -2100,46 +2363,46 @@ void MainWindow::cropImage()
 
     // X position spinner
     QSpinBox *xSpinBox = new QSpinBox(&dialog);
-    xSpinBox->setRange(0, layerPixmap.width() - 1);
+    xSpinBox->setRange(0, layerImage.width() - 1);
     xSpinBox->setValue(0);
     xSpinBox->setSuffix(tr(" px"));
     formLayout->addRow(tr("X:"), xSpinBox);
 
     // Y position spinner
     QSpinBox *ySpinBox = new QSpinBox(&dialog);
-    ySpinBox->setRange(0, layerPixmap.height() - 1);
+    ySpinBox->setRange(0, layerImage.height() - 1);
     ySpinBox->setValue(0);
     ySpinBox->setSuffix(tr(" px"));
     formLayout->addRow(tr("Y:"), ySpinBox);
 
     // Width spinner
     QSpinBox *widthSpinBox = new QSpinBox(&dialog);
-    widthSpinBox->setRange(1, layerPixmap.width());
-    widthSpinBox->setValue(layerPixmap.width());
+    widthSpinBox->setRange(1, layerImage.width());
+    widthSpinBox->setValue(layerImage.width());
     widthSpinBox->setSuffix(tr(" px"));
     formLayout->addRow(tr("Width:"), widthSpinBox);
 
     // Height spinner
     QSpinBox *heightSpinBox = new QSpinBox(&dialog);
-    heightSpinBox->setRange(1, layerPixmap.height());
-    heightSpinBox->setValue(layerPixmap.height());
+    heightSpinBox->setRange(1, layerImage.height());
+    heightSpinBox->setValue(layerImage.height());
     heightSpinBox->setSuffix(tr(" px"));
     formLayout->addRow(tr("Height:"), heightSpinBox);
 
     // Current size label
-    QLabel *currentSizeLabel = new QLabel(tr("Original size: %1 x %2 px").arg(layerPixmap.width()).arg(layerPixmap.height()), &dialog);
+    QLabel *currentSizeLabel = new QLabel(tr("Original size: %1 x %2 px").arg(layerImage.width()).arg(layerImage.height()), &dialog);
     formLayout->addRow(currentSizeLabel);
 
     // Update max values when x/y change
     connect(xSpinBox, QOverload<int>::of(&QSpinBox::valueChanged), [&](int value) {
-        widthSpinBox->setMaximum(layerPixmap.width() - value);
+        widthSpinBox->setMaximum(layerImage.width() - value);
         if (widthSpinBox->value() > widthSpinBox->maximum()) {
             widthSpinBox->setValue(widthSpinBox->maximum());
         }
     });
 
     connect(ySpinBox, QOverload<int>::of(&QSpinBox::valueChanged), [&](int value) {
-        heightSpinBox->setMaximum(layerPixmap.height() - value);
+        heightSpinBox->setMaximum(layerImage.height() - value);
         if (heightSpinBox->value() > heightSpinBox->maximum()) {
             heightSpinBox->setValue(heightSpinBox->maximum());
         }
@@ -2166,7 +2429,7 @@ void MainWindow::cropImage()
         // Validate crop region
         if (width > 0 && height > 0) {
             QRect cropRect(x, y, width, height);
-            currentLayer.pixmap() = layerPixmap.copy(cropRect);
+            currentLayer.setImage(layerImage.copy(cropRect));
 
             // Update the canvas
             canvas->compositeAllLayers();
@@ -2182,9 +2445,9 @@ void MainWindow::addDropShadow()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Add Drop Shadow"), tr("No image on current layer."));
         return;
     }
@@ -2242,14 +2505,14 @@ void MainWindow::addDropShadow()
         qreal opacity = opacitySpinBox->value() / 100.0;
 
         // Calculate new size to accommodate shadow
-        int newWidth = layerPixmap.width() + qAbs(offsetX) + blur * 2;
-        int newHeight = layerPixmap.height() + qAbs(offsetY) + blur * 2;
+        int newWidth = layerImage.width() + qAbs(offsetX) + blur * 2;
+        int newHeight = layerImage.height() + qAbs(offsetY) + blur * 2;
 
-        // Create new pixmap with space for shadow
-        QPixmap resultPixmap(newWidth, newHeight);
-        resultPixmap.fill(Qt::transparent);
+        // Create new image with space for shadow
+        QImage resultImage(newWidth, newHeight, QImage::Format_ARGB32_Premultiplied);
+        resultImage.fill(Qt::transparent);
 
-        QPainter painter(&resultPixmap);
+        QPainter painter(&resultImage);
         painter.setRenderHint(QPainter::Antialiasing);
         painter.setRenderHint(QPainter::SmoothPixmapTransform);
 
@@ -2259,17 +2522,17 @@ void MainWindow::addDropShadow()
 
         // Draw shadow (simple version - just a semi-transparent black copy)
         painter.setOpacity(opacity);
-        painter.drawPixmap(shadowX, shadowY, layerPixmap);
+        painter.drawImage(shadowX, shadowY, layerImage);
 
         // Draw original image on top
         int imageX = qMax(0, -offsetX) + blur;
         int imageY = qMax(0, -offsetY) + blur;
         painter.setOpacity(1.0);
-        painter.drawPixmap(imageX, imageY, layerPixmap);
+        painter.drawImage(imageX, imageY, layerImage);
 
         painter.end();
 
-        currentLayer.pixmap() = resultPixmap;
+        currentLayer.setImage(resultImage);
 
         // Update the canvas
         canvas->compositeAllLayers();
@@ -2284,9 +2547,9 @@ void MainWindow::addBorder()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Add Border"), tr("No image on current layer."));
         return;
     }
@@ -2328,14 +2591,14 @@ void MainWindow::addBorder()
         QColor borderColor = colorCombo->currentData().value<QColor>();
 
         // Calculate new size
-        int newWidth = layerPixmap.width() + borderWidth * 2;
-        int newHeight = layerPixmap.height() + borderWidth * 2;
+        int newWidth = layerImage.width() + borderWidth * 2;
+        int newHeight = layerImage.height() + borderWidth * 2;
 
-        // Create new pixmap with border
-        QPixmap resultPixmap(newWidth, newHeight);
-        resultPixmap.fill(Qt::transparent);
+        // Create new image with border
+        QImage resultImage(newWidth, newHeight, QImage::Format_ARGB32_Premultiplied);
+        resultImage.fill(Qt::transparent);
 
-        QPainter painter(&resultPixmap);
+        QPainter painter(&resultImage);
         painter.setRenderHint(QPainter::Antialiasing);
 
         // Draw border
@@ -2344,11 +2607,11 @@ void MainWindow::addBorder()
         painter.drawRect(0, 0, newWidth, newHeight);
 
         // Draw original image centered
-        painter.drawPixmap(borderWidth, borderWidth, layerPixmap);
+        painter.drawImage(borderWidth, borderWidth, layerImage);
 
         painter.end();
 
-        currentLayer.pixmap() = resultPixmap;
+        currentLayer.setImage(resultImage);
 
         // Update the canvas
         canvas->compositeAllLayers();
@@ -2363,9 +2626,9 @@ void MainWindow::adjustBrightnessContrast()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Adjust Brightness/Contrast"), tr("No image on current layer."));
         return;
     }
@@ -2404,7 +2667,7 @@ void MainWindow::adjustBrightnessContrast()
         int brightness = brightnessSpinBox->value();
         int contrast = contrastSpinBox->value();
 
-        QImage image = layerPixmap.toImage();
+        QImage image = layerImage;
         if (image.isNull()) return;
 
         // Apply brightness and contrast adjustments
@@ -2427,7 +2690,7 @@ void MainWindow::adjustBrightnessContrast()
             }
         }
 
-        currentLayer.pixmap() = QPixmap::fromImage(image);
+        currentLayer.setImage(image);
 
         // Update the canvas
         canvas->compositeAllLayers();
@@ -2442,9 +2705,9 @@ void MainWindow::posterize()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Posterize"), tr("No image on current layer."));
         return;
     }
@@ -2480,7 +2743,7 @@ void MainWindow::posterize()
     if (dialog.exec() == QDialog::Accepted) {
         int levels = levelsSpinBox->value();
 
-        QImage image = layerPixmap.toImage();
+        QImage image = layerImage;
         if (image.isNull()) return;
 
         // Posterize the image
@@ -2501,7 +2764,7 @@ void MainWindow::posterize()
             }
         }
 
-        currentLayer.pixmap() = QPixmap::fromImage(image);
+        currentLayer.setImage(image);
 
         // Update the canvas
         canvas->compositeAllLayers();
@@ -2516,9 +2779,9 @@ void MainWindow::halftone()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Halftone"), tr("No image on current layer."));
         return;
     }
@@ -2558,7 +2821,7 @@ void MainWindow::halftone()
         int patternType = patternCombo->currentData().toInt();
         int dotSize = dotSizeSpinBox->value();
 
-        QImage image = layerPixmap.toImage();
+        QImage image = layerImage;
         if (image.isNull()) return;
 
         if (patternType == 0) {
@@ -2588,7 +2851,7 @@ void MainWindow::halftone()
                 }
             }
 
-            currentLayer.pixmap() = QPixmap::fromImage(result);
+            currentLayer.setImage(result);
         } else {
             // Floyd-Steinberg dithering
             image = image.convertToFormat(QImage::Format_RGB32);
@@ -2632,7 +2895,7 @@ void MainWindow::halftone()
                 }
             }
 
-            currentLayer.pixmap() = QPixmap::fromImage(image);
+            currentLayer.setImage(image);
         }
 
         // Update the canvas
@@ -2648,14 +2911,14 @@ void MainWindow::edgeDetect()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Edge Detect"), tr("No image on current layer."));
         return;
     }
 
-    QImage image = layerPixmap.toImage();
+    QImage image = layerImage;
     if (image.isNull()) return;
 
     // Convert to grayscale first
@@ -2686,7 +2949,7 @@ void MainWindow::edgeDetect()
         }
     }
 
-    currentLayer.pixmap() = QPixmap::fromImage(result);
+    currentLayer.setImage(result);
 
     // Update the canvas
     canvas->compositeAllLayers();
@@ -2700,20 +2963,20 @@ void MainWindow::invertColors()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Invert Colors"), tr("No image on current layer."));
         return;
     }
 
-    QImage image = layerPixmap.toImage();
+    QImage image = layerImage;
     if (image.isNull()) return;
 
     // Invert all colors
     image.invertPixels();
 
-    currentLayer.pixmap() = QPixmap::fromImage(image);
+    currentLayer.setImage(image);
 
     // Update the canvas
     canvas->compositeAllLayers();
@@ -2727,9 +2990,9 @@ void MainWindow::despeckle()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Despeckle"), tr("No image on current layer."));
         return;
     }
@@ -2766,7 +3029,7 @@ void MainWindow::despeckle()
     if (dialog.exec() == QDialog::Accepted) {
         int radius = radiusSpinBox->value();
 
-        QImage image = layerPixmap.toImage();
+        QImage image = layerImage;
         if (image.isNull()) return;
 
         QImage result = image.copy();
@@ -2797,7 +3060,7 @@ void MainWindow::despeckle()
             }
         }
 
-        currentLayer.pixmap() = QPixmap::fromImage(result);
+        currentLayer.setImage(result);
 
         // Update the canvas
         canvas->compositeAllLayers();
@@ -2812,14 +3075,14 @@ void MainWindow::autoLevels()
     if (!canvas) return;
 
     Layer &currentLayer = canvas->currentLayer();
-    QPixmap layerPixmap = currentLayer.pixmap();
+    QImage layerImage = currentLayer.image();
 
-    if (layerPixmap.isNull()) {
+    if (layerImage.isNull()) {
         QMessageBox::warning(this, tr("Auto Levels"), tr("No image on current layer."));
         return;
     }
 
-    QImage image = layerPixmap.toImage();
+    QImage image = layerImage;
     if (image.isNull()) return;
 
     // Find min and max values for each channel
@@ -2856,7 +3119,7 @@ void MainWindow::autoLevels()
         }
     }
 
-    currentLayer.pixmap() = QPixmap::fromImage(image);
+    currentLayer.setImage(image);
 
     // Update the canvas
     canvas->compositeAllLayers();
@@ -2912,6 +3175,7 @@ void MainWindow::onPageDuplicated()
         canvas->update();
         emit canvas->layersChanged();
         updatePageIndicator();
+        updateStatusBar();
         statusBar()->showMessage(tr("Page duplicated"), 2000);
     }
 }
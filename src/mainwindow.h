@@ -100,6 +100,9 @@ private slots:
     void onRotateSelection270();
     void onFlipSelectionHorizontal();
     void onFlipSelectionVertical();
+    void onMagicWandSelected();
+    void onSelectByColorSelected();
+    void showWandTolerance();
     void onFontChanged(const QString &fontFamily);
     void onFontSizeChanged(int fontSize);
     void onThicknessSelected(int thickness);
@@ -142,6 +145,11 @@ private:
     void loadPreferences();
     void savePreferences();
     void applyAutoSaveSettings();
+    void autoSave();
+    QString recoveryDirectory() const; // Empty while auto-save is off
+    void recoverDocuments();
+    void applyUndoSettings();
+    void applyFillSettings();
     void connectCanvasSignals(Canvas *canvas);
     Canvas* getCurrentCanvas();
 
@@ -205,6 +213,9 @@ private:
     QAction *m_rotateSelection270Action;
     QAction *m_flipSelectionHorizontalAction;
     QAction *m_flipSelectionVerticalAction;
+    QAction *m_magicWandAction;
+    QAction *m_selectByColorAction;
+    QAction *m_wandToleranceAction;
 
     QAction *m_zoom25Action;
     QAction *m_zoom50Action;
@@ -306,4 +317,14 @@ private:
     QTimer *m_autoSaveTimer;
     bool m_autoSaveEnabled;
     int m_autoSaveInterval; // in minutes
+
+    // Undo history
+    int m_undoBudgetMB; // per canvas
+
+    // Fill tool
+    int m_fillTolerance;
+    int m_fillGapSize; // in pixels
+
+    // Magic wand and select by color
+    int m_wandTolerance;
 };
\ No newline at end of file
@@ -203,7 +203,7 @@ void TabWidget::onTabCloseRequested(int index)
                 fileName = QFileDialog::getSaveFileName(this,
                     tr("Save Document"),
                     QStandardPaths::writableLocation(QStandardPaths::PicturesLocation) + "/" + tabName + ".ora",
-                    tr("OpenRaster Files (*.ora);;PNG Files (*.png)"));
+                    tr("grfx Documents (*.grfx);;OpenRaster Files (*.ora);;PNG Files (*.png)"));
                 if (fileName.isEmpty()) {
                     return; // User cancelled save dialog
                 }